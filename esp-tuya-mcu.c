@@ -10,33 +10,121 @@
 #include <ctype.h>
 #include <freertos/FreeRTOS.h>
 #include <freertos/task.h>
+#include <freertos/queue.h>
+#include <freertos/semphr.h>
 #include <esp_log.h>
+#include <esp_timer.h>
 
-#define TX_BUFFER_SIZE 256
+#if !CONFIG_IDF_TARGET_ESP8266 && CONFIG_PM_ENABLE
+#include <esp_pm.h>
+#include <esp_sleep.h>
+#include <soc/soc_caps.h>
+#define TUYA_MCU_LIGHT_SLEEP 1
+#else
+#define TUYA_MCU_LIGHT_SLEEP 0
+#endif
+
+#define TX_BUFFER_SIZE (1024 + 64) /* Whole upgrade packet, next one is read while it goes out */
 #define RX_BUFFER_SIZE 256
 #define TUYA_MCU_EVENT_LOOP_QUEUE_SIZE (16)
 
 #define TUYA_MCU_TASK_STACK_SIZE (4096)
 #define TUYA_MCU_TASK_PRIORITY (tskIDLE_PRIORITY)
+#define TUYA_MCU_MAX_WAIT_MS (10000) /* Longest worker sleep, even without a deadline */
+#define TUYA_MCU_WAKE_HOLD_MS (200)  /* Light sleep is held off this long after link activity */
+#define TUYA_MCU_WAKEUP_EDGES (3)    /* Rx edges that wake the chip from light sleep, these bytes are lost */
+#define TUYA_MCU_SET_RETRIES (3)     /* Attempts to move a UART event queue in or out of the worker set */
 
 ESP_EVENT_DEFINE_BASE(TUYA_MCU_EVENT);
 
 static const char *TAG = "tuya_mcu";
 
 /**
- * @brief TUYA MCU runtime structure
+ * @brief Queued DP write
  *
  */
 typedef struct {
+    tuya_dp_ref_t          ref;    /*!< DP value */
+    tuya_mcu_dp_write_cb_t cb;     /*!< Completion callback, NULL if write is not tracked */
+    void                  *arg;    /*!< Argument for callback */
+    uint32_t               queued; /*!< Queue timestamp in us */
+} esp_tuya_mcu_dp_write_t;
+
+/**
+ * @brief Transfer run by the worker task
+ *
+ */
+typedef struct {
+    tuya_xfer_t          xfer;         /*!< Transfer in progress, NULL if none */
+    tuya_xfer_progress_t progress;     /*!< Application progress callback */
+    void                *progress_arg; /*!< Argument for application progress callback */
+    uint8_t              percent;      /*!< Progress last posted as event */
+    int32_t              event;        /*!< Progress event id */
+    void                *mcu;          /*!< Owning esp_tuya_mcu_t */
+    bool                 abort;        /*!< Abort requested, the worker fails the transfer */
+} esp_tuya_mcu_xfer_t;
+
+struct esp_tuya_mcu;
+
+/**
+ * @brief Worker task serving one or more TUYA MCUs
+ *
+ */
+typedef struct {
+    TaskHandle_t          tsk_hdl;          /*!< task handle */
+    QueueSetHandle_t      wake_set;         /*!< UART events of all served MCUs and wake_sem, task waits here */
+    SemaphoreHandle_t     wake_sem;         /*!< Given when an API call changes state of any served MCU */
+    SemaphoreHandle_t     lock;             /*!< Protects the MCU list and serving */
+    SemaphoreHandle_t     serve_lock;       /*!< Held by the task for a pass, recursive so handlers may detach */
+    struct esp_tuya_mcu  *instances;        /*!< Served MCUs */
+    struct esp_tuya_mcu **serving;          /*!< MCUs of the current pass, detached ones are NULLed */
+    uint8_t               serving_count;    /*!< Entries in serving */
+    uint8_t               count;            /*!< Served MCUs */
+    uint8_t               max_instances;    /*!< Max served MCUs */
+    uint32_t              event_queue_size; /*!< Max UART event queue size of a served MCU */
+} esp_tuya_mcu_worker_t;
+
+/**
+ * @brief TUYA MCU runtime structure
+ *
+ */
+typedef struct esp_tuya_mcu {
     uart_port_t             uart_port;         /*!< Uart port number */
     tuya_mcu_t              dev;               /*!< TUYA MCU dev handle */
-    TaskHandle_t            tsk_hdl;           /*!< task handle */
+    esp_tuya_mcu_worker_t  *worker;            /*!< Task serving this MCU */
+    struct esp_tuya_mcu    *next;              /*!< Next MCU served by the same worker */
     esp_event_loop_handle_t event_loop_hdl;    /*!< Event loop handle */
     QueueHandle_t           event_queue;       /*!< UART event queue handle */
     QueueHandle_t           wifi_status_queue; /*!< WiFi send queue handle */
-    QueueHandle_t           dp_queue;          /*!< DP send queue handle */
+    QueueHandle_t           dp_queue;          /*!< DP send queue handle, carries esp_tuya_mcu_dp_write_t */
+    tuya_dp_pool_t          dp_pool;           /*!< Storage of queued and event DPs */
+    tuya_dp_pool_t          shadow_pool;       /*!< Storage of shadow DPs, one record per reported id */
+    SemaphoreHandle_t       lock;              /*!< Protects dev state shared with API callers */
+    tuya_dp_ref_t           event_refs[TUYA_MCU_EVENT_LOOP_QUEUE_SIZE]; /*!< DP of each undispatched event */
+    uint32_t                event_head;        /*!< Oldest undispatched event, protected by lock */
+    uint32_t                events_pending;    /*!< Events posted and not dispatched yet, protected by lock */
+    tuya_mcu_dp_event_mode_t dp_event_mode;    /*!< DP update event flavour */
+    esp_tuya_mcu_xfer_t     ota;               /*!< MCU firmware upgrade */
+    esp_tuya_mcu_xfer_t     file;              /*!< File download */
+    uint8_t                 dp_batch_max;      /*!< Max DPs per data frame */
+    TickType_t              dp_batch_delay;    /*!< Max wait for more DPs */
+    TickType_t              dp_batch_due;      /*!< Queued DPs are sent by then even if the batch is not full */
+    bool                    dp_batch_pending;  /*!< dp_batch_due is set, DPs wait for more of the same burst */
+    bool                    dp_shadow;         /*!< DP shadow enabled */
+    bool                    skip_duplicates;   /*!< Drop writes equal to shadow value */
+    uint8_t                 dp_queued[256];    /*!< Writes of each DP id queued and not sent yet, protected by lock */
+    esp_tuya_mcu_stats_t    stats;             /*!< Statistics, proto is filled in on read */
+    TickType_t              deadline;          /*!< Worker serves it by then even without UART events */
+    uint32_t                deadline_us;       /*!< Same in tuya_mcu_get_time_us, for wake_late_us */
+#if TUYA_MCU_LIGHT_SLEEP
+    esp_pm_lock_handle_t    pm_lock;           /*!< Keeps the chip awake while the link is busy, NULL if disabled */
+    bool                    pm_held;           /*!< pm_lock acquired */
+    TickType_t              awake_until;       /*!< pm_lock is released after this */
+#endif
 } esp_tuya_mcu_t;
 
+static esp_tuya_mcu_worker_t *shared_worker; /*!< Worker of esp_tuya_mcu_worker_init */
+
 /* Platform functions */
 int tuya_mcu_uart_rx(void *ctx, uint8_t *c)
 {
@@ -50,89 +138,513 @@ int tuya_mcu_uart_tx(void *ctx, uint8_t c)
     return uart_write_bytes(mcu->uart_port, (const char *)&c, 1);
 }
 
+int tuya_mcu_uart_write(void *ctx, const uint8_t *buf, size_t len)
+{
+    esp_tuya_mcu_t *mcu = (esp_tuya_mcu_t *)ctx;
+    return uart_write_bytes(mcu->uart_port, (const char *)buf, len);
+}
+
+int tuya_mcu_uart_read(void *ctx, uint8_t *buf, size_t len, uint32_t timeout_ms)
+{
+    esp_tuya_mcu_t *mcu = (esp_tuya_mcu_t *)ctx;
+    return uart_read_bytes(mcu->uart_port, buf, len, pdMS_TO_TICKS(timeout_ms));
+}
+
+int tuya_mcu_uart_set_baud(void *ctx, uint32_t baud)
+{
+    esp_tuya_mcu_t *mcu = (esp_tuya_mcu_t *)ctx;
+    if (uart_set_baudrate(mcu->uart_port, baud) != ESP_OK)
+        return -1;
+    /* Bytes received at the old rate are garbage now */
+    uart_flush_input(mcu->uart_port);
+    return 0;
+}
+
+#ifdef CONFIG_IDF_TARGET_ESP8266
+void tuya_mcu_enter_critical(void)
+{
+    portENTER_CRITICAL();
+}
+
+void tuya_mcu_exit_critical(void)
+{
+    portEXIT_CRITICAL();
+}
+#else
+static portMUX_TYPE tuya_mcu_mux = portMUX_INITIALIZER_UNLOCKED;
+
+void tuya_mcu_enter_critical(void)
+{
+    portENTER_CRITICAL(&tuya_mcu_mux);
+}
+
+void tuya_mcu_exit_critical(void)
+{
+    portEXIT_CRITICAL(&tuya_mcu_mux);
+}
+#endif
+
 uint32_t tuya_mcu_get_tick(void)
 {
     return (uint32_t)((uint64_t)xTaskGetTickCount() * (1000ULL / configTICK_RATE_HZ));
 }
 
-static void esp_tuya_mcu_task_entry(void *arg)
+uint32_t tuya_mcu_get_time_us(void)
 {
-    esp_tuya_mcu_t *mcu = (esp_tuya_mcu_t *)arg;
-    uart_event_t    event;
-    tuya_dp_t       dp;
-    uint8_t         wifi_state;
+    return (uint32_t)esp_timer_get_time();
+}
 
-    ESP_LOGI(TAG, "task started on UART%d", mcu->uart_port);
-    while (1) {
-        if (xQueueReceive(mcu->event_queue, &event, pdMS_TO_TICKS(200))) {
-            switch (event.type) {
-            case UART_DATA:
-                break;
-            case UART_FIFO_OVF:
-                ESP_LOGW(TAG, "HW FIFO Overflow");
-                uart_flush(mcu->uart_port);
-                xQueueReset(mcu->event_queue);
-                break;
-            case UART_BUFFER_FULL:
-                ESP_LOGW(TAG, "Ring Buffer Full");
-                uart_flush(mcu->uart_port);
-                xQueueReset(mcu->event_queue);
-                break;
-            case UART_PARITY_ERR:
-                ESP_LOGE(TAG, "Parity Error");
-                break;
-            case UART_FRAME_ERR:
-                ESP_LOGE(TAG, "Frame Error");
-                break;
+static inline void esp_tuya_mcu_hwm(uint8_t *hwm, uint32_t level)
+{
+    if (level > *hwm)
+        *hwm = level > UINT8_MAX ? UINT8_MAX : level;
+}
+
+static void esp_tuya_mcu_handle_uart_event(esp_tuya_mcu_t *mcu, const uart_event_t *event)
+{
+    /* Event queue is a queue set member, so it is not reset on overflow: stale entries in the set
+     * would outnumber the queue items. Flushing the driver buffer is enough. */
+    switch (event->type) {
+    case UART_DATA:
+        break;
+    case UART_FIFO_OVF:
+        ESP_LOGW(TAG, "HW FIFO Overflow");
+        mcu->stats.uart_fifo_overflows++;
+        uart_flush(mcu->uart_port);
+        break;
+    case UART_BUFFER_FULL:
+        ESP_LOGW(TAG, "Ring Buffer Full");
+        mcu->stats.uart_buffer_full++;
+        uart_flush(mcu->uart_port);
+        break;
+    case UART_PARITY_ERR:
+        ESP_LOGE(TAG, "Parity Error");
+        mcu->stats.uart_errors++;
+        break;
+    case UART_FRAME_ERR:
+        ESP_LOGE(TAG, "Frame Error");
+        mcu->stats.uart_errors++;
+        break;
 #ifndef CONFIG_IDF_TARGET_ESP8266
-            case UART_PATTERN_DET:
-                break;
-            case UART_BREAK:
-                ESP_LOGW(TAG, "Rx Break");
-                break;
+    case UART_PATTERN_DET:
+        break;
+    case UART_BREAK:
+        ESP_LOGW(TAG, "Rx Break");
+        break;
 #endif
-            default:
-                ESP_LOGW(TAG, "unknown uart event type: %d", event.type);
-                break;
+    default:
+        ESP_LOGW(TAG, "unknown uart event type: %d", event->type);
+        break;
+    }
+}
+
+static esp_err_t esp_tuya_mcu_post_event(esp_tuya_mcu_t *mcu, int32_t id, const void *data, size_t len,
+                                         tuya_dp_ref_t ref)
+{
+    /* Caller holds mcu->lock, keeping the ring in loop queue order. Loop is run by our own task, waiting for room
+     * would never end */
+    esp_err_t err = esp_event_post_to(mcu->event_loop_hdl, TUYA_MCU_EVENT, id, data, len, 0);
+    if (err != ESP_OK) {
+        ESP_LOGW(TAG, "event %d dropped", (int)id);
+        mcu->stats.events_dropped++;
+        return err;
+    }
+    /* Loop queue holds at most TUYA_MCU_EVENT_LOOP_QUEUE_SIZE events, so the ring can't overflow */
+    mcu->event_refs[(mcu->event_head + mcu->events_pending) % TUYA_MCU_EVENT_LOOP_QUEUE_SIZE] = ref;
+    mcu->events_pending++;
+    esp_tuya_mcu_hwm(&mcu->stats.events_hwm, mcu->events_pending);
+    return ESP_OK;
+}
+
+static void esp_tuya_mcu_dispatch_events(esp_tuya_mcu_t *mcu)
+{
+    tuya_dp_ref_t ref;
+
+    /* API calls on other tasks post too, the ring is only touched with the lock held, handlers run without it */
+    xSemaphoreTake(mcu->lock, portMAX_DELAY);
+    while (mcu->events_pending) {
+        xSemaphoreGive(mcu->lock);
+        /* With no time to run the loop handles exactly one queued event per call */
+        esp_event_loop_run(mcu->event_loop_hdl, 0);
+        xSemaphoreTake(mcu->lock, portMAX_DELAY);
+        /* All handlers of the event returned, drop the reference it held */
+        ref = mcu->event_refs[mcu->event_head];
+        mcu->event_head = (mcu->event_head + 1) % TUYA_MCU_EVENT_LOOP_QUEUE_SIZE;
+        mcu->events_pending--;
+        tuya_dp_pool_release(mcu->dp_pool, ref);
+    }
+    xSemaphoreGive(mcu->lock);
+}
+
+/* Tick time at passed, with wraparound */
+static inline bool esp_tuya_mcu_due(TickType_t at, TickType_t now)
+{
+    return now - at < portMAX_DELAY / 2;
+}
+
+static void esp_tuya_mcu_send_dps(esp_tuya_mcu_t *mcu)
+{
+    esp_tuya_mcu_dp_write_t writes[TUYA_MCU_DP_QUEUE_SIZE];
+    tuya_dp_view_t          views[TUYA_MCU_DP_QUEUE_SIZE];
+    bool                    sent[TUYA_MCU_DP_QUEUE_SIZE];
+    size_t                  count;
+    UBaseType_t             waiting;
+    TickType_t              tick;
+    int                     frames;
+    uint32_t                now;
+
+    waiting = uxQueueMessagesWaiting(mcu->dp_queue);
+    esp_tuya_mcu_hwm(&mcu->stats.dp_queue_hwm, waiting);
+    if (!waiting) {
+        mcu->dp_batch_pending = false;
+        return;
+    }
+    /* Give late DPs of the same burst a chance to share the frame, the deadline keeps the worker serving others */
+    if (waiting < mcu->dp_batch_max && mcu->dp_batch_delay) {
+        tick = xTaskGetTickCount();
+        if (!mcu->dp_batch_pending) {
+            mcu->dp_batch_pending = true;
+            mcu->dp_batch_due = tick + mcu->dp_batch_delay;
+            return;
+        }
+        if (!esp_tuya_mcu_due(mcu->dp_batch_due, tick))
+            return;
+    }
+    mcu->dp_batch_pending = false;
+
+    do {
+        count = 0;
+        while (count < mcu->dp_batch_max && xQueueReceive(mcu->dp_queue, &writes[count], 0))
+            count++;
+        if (!count)
+            return;
+
+        for (size_t i = 0; i < count; i++)
+            tuya_dp_ref_view(writes[i].ref, &views[i]);
+        xSemaphoreTake(mcu->lock, portMAX_DELAY);
+        frames = tuya_mcu_send_dp_views(mcu->dev, views, count, sent);
+        now = tuya_mcu_get_time_us();
+        for (size_t i = 0; i < count; i++) {
+            if (sent[i])
+                tuya_mcu_hist_add(mcu->stats.dp_write_us, now - writes[i].queued);
+        }
+        /* One oversize DP fails alone, the rest of the batch went out */
+        for (size_t i = 0; i < count; i++) {
+            mcu->dp_queued[views[i].id]--;
+            if (!writes[i].cb)
+                continue;
+            if (!sent[i] || tuya_mcu_track_dp_write(mcu->dev, &views[i], writes[i].cb, writes[i].arg) != 0) {
+                tuya_mcu_dp_write_result_t result = { .id = views[i].id, .status = TUYA_MCU_DP_WRITE_FAILED };
+                writes[i].cb(mcu->dev, &result, writes[i].arg);
             }
         }
+        xSemaphoreGive(mcu->lock);
+        for (size_t i = 0; i < count; i++)
+            tuya_dp_pool_release(mcu->dp_pool, writes[i].ref);
+        ESP_LOGI(TAG, "%d DPs sent in %d frames", (int)count, frames);
+    } while (count == mcu->dp_batch_max);
+}
+
+static void esp_tuya_mcu_tick_xfer(esp_tuya_mcu_xfer_t *xfer)
+{
+    if (!xfer->xfer)
+        return;
+    /* Failing it reports progress, only the worker does that */
+    if (xfer->abort)
+        tuya_xfer_abort(xfer->xfer);
+    else
+        tuya_xfer_tick(xfer->xfer);
+    if (tuya_xfer_finished(xfer->xfer)) {
+        tuya_xfer_destroy(xfer->xfer);
+        xfer->xfer = NULL;
+    }
+}
+
+/* Light sleep would drop the start of the answers still to come, stay awake a while */
+static void esp_tuya_mcu_hold_awake(esp_tuya_mcu_t *mcu, TickType_t now)
+{
+#if TUYA_MCU_LIGHT_SLEEP
+    if (!mcu->pm_lock)
+        return;
+    if (!mcu->pm_held && esp_pm_lock_acquire(mcu->pm_lock) == ESP_OK)
+        mcu->pm_held = true;
+    mcu->awake_until = now + pdMS_TO_TICKS(TUYA_MCU_WAKE_HOLD_MS);
+#endif
+}
 
-        if (xQueueReceive(mcu->wifi_status_queue, &wifi_state, pdMS_TO_TICKS(200))) {
-            tuya_mcu_send_wifi_status(mcu->dev, wifi_state);
-            ESP_LOGI(TAG, "WiFi status %d sent", wifi_state);
+static void esp_tuya_mcu_allow_sleep(esp_tuya_mcu_t *mcu, TickType_t now)
+{
+#if TUYA_MCU_LIGHT_SLEEP
+    if (mcu->pm_held && esp_tuya_mcu_due(mcu->awake_until, now)) {
+        esp_pm_lock_release(mcu->pm_lock);
+        mcu->pm_held = false;
+    }
+#endif
+}
+
+/* Everything but UART events: queued WiFi status and DPs, state machine, transfers, events */
+static void esp_tuya_mcu_service(esp_tuya_mcu_t *mcu)
+{
+    uint8_t    wifi_state;
+    uint32_t   next;
+    uint32_t   batch;
+    TickType_t now;
+
+    mcu->stats.wakeups++;
+    while (xQueueReceive(mcu->wifi_status_queue, &wifi_state, 0)) {
+        xSemaphoreTake(mcu->lock, portMAX_DELAY);
+        tuya_mcu_send_wifi_status(mcu->dev, wifi_state);
+        xSemaphoreGive(mcu->lock);
+        ESP_LOGI(TAG, "WiFi status %d sent", wifi_state);
+    }
+
+    esp_tuya_mcu_send_dps(mcu);
+    xSemaphoreTake(mcu->lock, portMAX_DELAY);
+    tuya_mcu_tick(mcu->dev);
+    esp_tuya_mcu_tick_xfer(&mcu->ota);
+    esp_tuya_mcu_tick_xfer(&mcu->file);
+    /* Sleep until the engine, a transfer or a DP batch has timed work, UART events and API calls wake earlier */
+    next = tuya_mcu_next_deadline(mcu->dev);
+    if (tuya_xfer_next_deadline(mcu->ota.xfer) < next)
+        next = tuya_xfer_next_deadline(mcu->ota.xfer);
+    if (tuya_xfer_next_deadline(mcu->file.xfer) < next)
+        next = tuya_xfer_next_deadline(mcu->file.xfer);
+    xSemaphoreGive(mcu->lock);
+    if (mcu->dp_batch_pending) {
+        now = xTaskGetTickCount();
+        batch = esp_tuya_mcu_due(mcu->dp_batch_due, now) ? 0 : (mcu->dp_batch_due - now) * portTICK_PERIOD_MS;
+        if (batch < next)
+            next = batch;
+    }
+    if (next > TUYA_MCU_MAX_WAIT_MS)
+        next = TUYA_MCU_MAX_WAIT_MS;
+    /* Rounded up, waking a tick early would find nothing to do */
+    mcu->deadline = xTaskGetTickCount() + (next + portTICK_PERIOD_MS - 1) / portTICK_PERIOD_MS;
+    mcu->deadline_us = tuya_mcu_get_time_us() + next * 1000;
+    esp_tuya_mcu_dispatch_events(mcu);
+}
+
+/* Ticks until the earliest deadline of the served MCUs */
+static TickType_t esp_tuya_mcu_worker_wait(esp_tuya_mcu_worker_t *worker)
+{
+    TickType_t      now = xTaskGetTickCount();
+    TickType_t      wait = pdMS_TO_TICKS(TUYA_MCU_MAX_WAIT_MS);
+    esp_tuya_mcu_t *mcu;
+
+    xSemaphoreTake(worker->lock, portMAX_DELAY);
+    for (mcu = worker->instances; mcu; mcu = mcu->next) {
+        if (esp_tuya_mcu_due(mcu->deadline, now)) {
+            wait = 0;
+            break;
         }
+        if (mcu->deadline - now < wait)
+            wait = mcu->deadline - now;
+#if TUYA_MCU_LIGHT_SLEEP
+        if (mcu->pm_held && esp_tuya_mcu_due(mcu->awake_until, now))
+            wait = 0;
+        else if (mcu->pm_held && mcu->awake_until - now < wait)
+            wait = mcu->awake_until - now;
+#endif
+    }
+    xSemaphoreGive(worker->lock);
+    return wait;
+}
+
+static void esp_tuya_mcu_task_entry(void *arg)
+{
+    esp_tuya_mcu_worker_t *worker = (esp_tuya_mcu_worker_t *)arg;
+    QueueSetMemberHandle_t member;
+    uart_event_t           event;
+    esp_tuya_mcu_t        *mcu;
+    TickType_t             now;
+    bool                   woken;
+    uint8_t                count;
+
+    ESP_LOGI(TAG, "task started for %d MCUs", worker->max_instances);
+    while (1) {
+        /* Single wait point: UART event, queued WiFi status/DP or the earliest deadline */
+        member = xQueueSelectFromSet(worker->wake_set, esp_tuya_mcu_worker_wait(worker));
+        woken = member == worker->wake_sem;
+        if (woken)
+            xSemaphoreTake(worker->wake_sem, 0);
+        now = xTaskGetTickCount();
 
-        if (xQueueReceive(mcu->dp_queue, &dp, pdMS_TO_TICKS(200))) {
-            tuya_mcu_send_dp(mcu->dev, &dp);
-            ESP_LOGI(TAG, "DP sent: ID=%d, Type=%d, Len=%d", dp.id, dp.type, tuya_dp_get_len(&dp));
+        /* Handlers run without the list lock, they may init or deinit other MCUs of the worker */
+        xSemaphoreTakeRecursive(worker->serve_lock, portMAX_DELAY);
+        xSemaphoreTake(worker->lock, portMAX_DELAY);
+        count = 0;
+        for (mcu = worker->instances; mcu; mcu = mcu->next)
+            worker->serving[count++] = mcu;
+        worker->serving_count = count;
+        xSemaphoreGive(worker->lock);
+
+        /* A UART event only concerns its own MCU, the others wait for their deadline */
+        for (uint8_t i = 0; i < count; i++) {
+            xSemaphoreTake(worker->lock, portMAX_DELAY);
+            mcu = worker->serving[i];
+            xSemaphoreGive(worker->lock);
+            if (!mcu)
+                continue;
+            if (member == mcu->event_queue) {
+                esp_tuya_mcu_hwm(&mcu->stats.uart_queue_hwm, uxQueueMessagesWaiting(mcu->event_queue));
+                if (xQueueReceive(mcu->event_queue, &event, 0))
+                    esp_tuya_mcu_handle_uart_event(mcu, &event);
+                esp_tuya_mcu_hold_awake(mcu, now);
+                esp_tuya_mcu_service(mcu);
+            } else if (esp_tuya_mcu_due(mcu->deadline, now)) {
+                tuya_mcu_hist_add(mcu->stats.wake_late_us, tuya_mcu_get_time_us() - mcu->deadline_us);
+                /* Timed work usually means a heartbeat or resend, its answer is on the way */
+                esp_tuya_mcu_hold_awake(mcu, now);
+                esp_tuya_mcu_service(mcu);
+            } else if (woken) {
+                esp_tuya_mcu_hold_awake(mcu, now);
+                esp_tuya_mcu_service(mcu);
+            } else {
+                esp_tuya_mcu_allow_sleep(mcu, now);
+            }
         }
-        tuya_mcu_tick(mcu->dev);
-        esp_event_loop_run(mcu->event_loop_hdl, pdMS_TO_TICKS(50));
+        xSemaphoreTake(worker->lock, portMAX_DELAY);
+        worker->serving_count = 0;
+        xSemaphoreGive(worker->lock);
+        xSemaphoreGiveRecursive(worker->serve_lock);
     }
     vTaskDelete(NULL);
 }
 
+static void esp_tuya_mcu_worker_destroy(esp_tuya_mcu_worker_t *worker)
+{
+    if (worker->tsk_hdl)
+        vTaskDelete(worker->tsk_hdl);
+    if (worker->wake_set)
+        vQueueDelete(worker->wake_set);
+    if (worker->wake_sem)
+        vSemaphoreDelete(worker->wake_sem);
+    if (worker->lock)
+        vSemaphoreDelete(worker->lock);
+    if (worker->serve_lock)
+        vSemaphoreDelete(worker->serve_lock);
+    free(worker->serving);
+    free(worker);
+}
+
+static esp_tuya_mcu_worker_t *esp_tuya_mcu_worker_create(uint8_t max_instances, uint32_t event_queue_size)
+{
+    esp_tuya_mcu_worker_t *worker = calloc(1, sizeof(esp_tuya_mcu_worker_t));
+    if (!worker) {
+        ESP_LOGE(TAG, "calloc failed");
+        return NULL;
+    }
+    worker->max_instances = max_instances;
+    worker->event_queue_size = event_queue_size;
+
+    worker->serving = calloc(max_instances, sizeof(*worker->serving));
+    worker->lock = xSemaphoreCreateMutex();
+    worker->serve_lock = xSemaphoreCreateRecursiveMutex();
+    worker->wake_sem = xSemaphoreCreateBinary();
+    /* Room for every event of every served UART plus the wake semaphore */
+    worker->wake_set = xQueueCreateSet(max_instances * event_queue_size + 1);
+    if (!worker->serving || !worker->lock || !worker->serve_lock || !worker->wake_sem || !worker->wake_set) {
+        ESP_LOGE(TAG, "create worker sync objects failed");
+        goto err;
+    }
+    xQueueAddToSet(worker->wake_sem, worker->wake_set);
+
+    if (xTaskCreate(esp_tuya_mcu_task_entry, "tuya_mcu_task", TUYA_MCU_TASK_STACK_SIZE, worker,
+                    TUYA_MCU_TASK_PRIORITY, &worker->tsk_hdl) != pdTRUE) {
+        ESP_LOGE(TAG, "task create failed");
+        goto err;
+    }
+    return worker;
+err:
+    esp_tuya_mcu_worker_destroy(worker);
+    return NULL;
+}
+
+/* Both need an empty queue, rx interrupts are off so the driver posts nothing in between */
+static BaseType_t esp_tuya_mcu_set_member(esp_tuya_mcu_t *mcu, QueueSetHandle_t set, bool add)
+{
+    BaseType_t ret = pdFAIL;
+
+    uart_disable_rx_intr(mcu->uart_port);
+    for (int i = 0; ret != pdPASS && i < TUYA_MCU_SET_RETRIES; i++) {
+        xQueueReset(mcu->event_queue);
+        ret = add ? xQueueAddToSet(mcu->event_queue, set) : xQueueRemoveFromSet(mcu->event_queue, set);
+    }
+    uart_enable_rx_intr(mcu->uart_port);
+    return ret;
+}
+
+static esp_err_t esp_tuya_mcu_worker_attach(esp_tuya_mcu_worker_t *worker, esp_tuya_mcu_t *mcu,
+                                            uint32_t event_queue_size)
+{
+    esp_err_t err = ESP_OK;
+
+    xSemaphoreTake(worker->lock, portMAX_DELAY);
+    if (worker->count >= worker->max_instances || event_queue_size > worker->event_queue_size) {
+        err = ESP_ERR_NO_MEM;
+    } else if (esp_tuya_mcu_set_member(mcu, worker->wake_set, true) != pdPASS) {
+        err = ESP_FAIL;
+    } else {
+        mcu->worker = worker;
+        mcu->next = worker->instances;
+        worker->instances = mcu;
+        worker->count++;
+        mcu->deadline = xTaskGetTickCount();
+        mcu->deadline_us = tuya_mcu_get_time_us();
+    }
+    xSemaphoreGive(worker->lock);
+    /* Worker may be asleep until the deadline of another MCU */
+    xSemaphoreGive(worker->wake_sem);
+    return err;
+}
+
+static void esp_tuya_mcu_worker_detach(esp_tuya_mcu_worker_t *worker, esp_tuya_mcu_t *mcu)
+{
+    esp_tuya_mcu_t **link;
+
+    xSemaphoreTake(worker->lock, portMAX_DELAY);
+    for (link = &worker->instances; *link; link = &(*link)->next) {
+        if (*link == mcu) {
+            *link = mcu->next;
+            worker->count--;
+            break;
+        }
+    }
+    for (uint8_t i = 0; i < worker->serving_count; i++) {
+        if (worker->serving[i] == mcu)
+            worker->serving[i] = NULL;
+    }
+    /* Set may still name the queue, the task ignores members it does not serve */
+    if (esp_tuya_mcu_set_member(mcu, worker->wake_set, false) != pdPASS)
+        ESP_LOGE(TAG, "UART %d event queue left in worker set", mcu->uart_port);
+    xSemaphoreGive(worker->lock);
+    /* A pass already serving it ends first, on the worker task itself this returns at once */
+    xSemaphoreTakeRecursive(worker->serve_lock, portMAX_DELAY);
+    xSemaphoreGiveRecursive(worker->serve_lock);
+}
+
 static int on_state_changed(tuya_mcu_t dev, enum tuya_mcu_state st, void *arg)
 {
     esp_tuya_mcu_t *mcu = (esp_tuya_mcu_t *)arg;
 
     switch (st) {
     case TUYA_MCU_INIT_HEARTBEAT:
+        /* Only entered again after init: heartbeats went unanswered or the MCU rebooted */
+        ESP_LOGW(TAG, "link to MCU lost, restarting handshake");
         break;
     case TUYA_MCU_QUERY_INFO:
         ESP_LOGI(TAG, "dev info queried");
         break;
     case TUYA_MCU_INITIALIZED: {
-        const char *pid = tuya_mcu_get_product_id(dev);
-        const char *ver = tuya_mcu_get_version(dev);
-        ESP_LOGI(TAG, "device initialized: ID=%s, ver=%s", pid, ver);
+        const tuya_mcu_product_info_t *info = tuya_mcu_get_product_info(dev);
+        ESP_LOGI(TAG, "device initialized: ID=%s, ver=%s, mode=%d, low power=%d", info->product_id, info->version,
+                 info->m, info->low);
     } break;
     default:
         ESP_LOGE(TAG, "unknown state: %d\n", st);
         break;
     }
-    esp_event_post_to(mcu->event_loop_hdl, TUYA_MCU_EVENT, TUYA_MCU_EVENT_STATE_CHANGED, &st,
-                      sizeof(st), pdMS_TO_TICKS(100));
+    esp_tuya_mcu_post_event(mcu, TUYA_MCU_EVENT_STATE_CHANGED, &st, sizeof(st), NULL);
     return 0;
 }
 
@@ -141,21 +653,113 @@ static int on_config_request(tuya_mcu_t dev, void *arg)
     esp_tuya_mcu_t *mcu = (esp_tuya_mcu_t *)arg;
 
     ESP_LOGI(TAG, "receved config request");
-    esp_event_post_to(mcu->event_loop_hdl, TUYA_MCU_EVENT, TUYA_MCU_EVENT_CONFIG_REQUEST, NULL, 0,
-                      pdMS_TO_TICKS(100));
+    esp_tuya_mcu_post_event(mcu, TUYA_MCU_EVENT_CONFIG_REQUEST, NULL, 0, NULL);
     return 0;
 }
 
 static int on_dp_received(tuya_mcu_t dev, tuya_dp_t *dp, void *arg)
 {
     esp_tuya_mcu_t *mcu = (esp_tuya_mcu_t *)arg;
-    size_t          len = tuya_dp_get_len(dp);
-    return esp_event_post_to(mcu->event_loop_hdl, TUYA_MCU_EVENT, TUYA_MCU_EVENT_DP_UPDATE, dp, len,
-                             pdMS_TO_TICKS(100));
+    return esp_tuya_mcu_post_event(mcu, TUYA_MCU_EVENT_DP_UPDATE, dp, sizeof(tuya_dp_t), NULL);
+}
+
+static int on_sync_report(tuya_mcu_t dev, uint16_t id, const uint8_t *dps, size_t len, void *arg)
+{
+    esp_tuya_mcu_t        *mcu = (esp_tuya_mcu_t *)arg;
+    tuya_mcu_sync_report_t report = { .id = id, .success = false };
+    /* A report nobody sees would only time out, fail it now if the event is dropped */
+    return esp_tuya_mcu_post_event(mcu, TUYA_MCU_EVENT_SYNC_REPORT, &report, sizeof(report), NULL) == ESP_OK ? 0 : -1;
+}
+
+static void on_sync_report_done(tuya_mcu_t dev, uint16_t id, bool success, void *arg)
+{
+    esp_tuya_mcu_t        *mcu = (esp_tuya_mcu_t *)arg;
+    tuya_mcu_sync_report_t report = { .id = id, .success = success };
+    esp_tuya_mcu_post_event(mcu, TUYA_MCU_EVENT_SYNC_REPORT_DONE, &report, sizeof(report), NULL);
+}
+
+static void on_dp_write_done(tuya_mcu_t dev, const tuya_mcu_dp_write_result_t *result, void *arg)
+{
+    esp_tuya_mcu_t *mcu = (esp_tuya_mcu_t *)arg;
+    esp_tuya_mcu_post_event(mcu, TUYA_MCU_EVENT_DP_WRITE_DONE, result, sizeof(*result), NULL);
+}
+
+static void on_baud_changed(tuya_mcu_t dev, uint32_t baud, bool ok, void *arg)
+{
+    esp_tuya_mcu_t *mcu = (esp_tuya_mcu_t *)arg;
+    tuya_mcu_baud_t event = { .baud = baud, .ok = ok };
+
+    if (ok)
+        ESP_LOGI(TAG, "UART at %" PRIu32 " baud", baud);
+    else
+        ESP_LOGW(TAG, "MCU silent at %" PRIu32 " baud, back to %" PRIu32, baud, tuya_mcu_get_baud(dev));
+    esp_tuya_mcu_post_event(mcu, TUYA_MCU_EVENT_BAUD_CHANGED, &event, sizeof(event), NULL);
+}
+
+static void on_xfer_progress(tuya_xfer_t xfer, const tuya_xfer_status_t *status, void *arg)
+{
+    esp_tuya_mcu_xfer_t *slot = (esp_tuya_mcu_xfer_t *)arg;
+    uint8_t              percent = status->size ? (uint64_t)status->acked * 100 / status->size : 100;
+
+    if (slot->progress)
+        slot->progress(xfer, status, slot->progress_arg);
+    /* One event per percent keeps the loop queue free for DP events */
+    if (status->state == TUYA_XFER_SENDING && percent == slot->percent)
+        return;
+    slot->percent = percent;
+    esp_tuya_mcu_post_event(slot->mcu, slot->event, status, sizeof(*status), NULL);
+}
+
+static int on_dps_received(tuya_mcu_t dev, const uint8_t *dps, size_t len, void *arg)
+{
+    esp_tuya_mcu_t *mcu = (esp_tuya_mcu_t *)arg;
+    tuya_dp_iter_t  it;
+    tuya_dp_view_t  view;
+    tuya_dp_ref_t   ref;
+
+    tuya_dp_iter_init(&it, dps, len);
+    while (tuya_dp_iter_next(&it, &view) > 0) {
+        if (view.len > TUYA_DP_CHUNK_SIZE) {
+            /* No pool size fits it, tuya_dp_t of the copy flavour can not hold it either */
+            ESP_LOGW(TAG, "DP %d dropped, %d bytes over the %d byte limit", view.id, view.len, TUYA_DP_CHUNK_SIZE);
+            mcu->stats.dp_too_large++;
+            continue;
+        }
+        ref = tuya_dp_pool_alloc(mcu->dp_pool, &view);
+        if (!ref) {
+            ESP_LOGW(TAG, "DP %d dropped, pool exhausted", view.id);
+            mcu->stats.dp_pool_exhausted++;
+            continue;
+        }
+        /* Event carries the handle only, the reference is dropped after dispatch */
+        if (esp_tuya_mcu_post_event(mcu, TUYA_MCU_EVENT_DP_REF, &ref, sizeof(ref), ref) != ESP_OK)
+            tuya_dp_pool_release(mcu->dp_pool, ref);
+    }
+    return 0;
+}
+
+/* Start at the configured rate, or probe common ones from it until the MCU answers */
+static int esp_tuya_mcu_start_baud(esp_tuya_mcu_t *mcu, const tuya_mcu_uart_config_t *config)
+{
+    static const uint32_t common[] = { 9600, 19200, 38400, 57600, 115200 };
+    uint32_t              rates[TUYA_MCU_BAUD_RATES_MAX] = { config->uart.baud_rate };
+    size_t                count = 1;
+
+    for (size_t i = 0; config->uart.auto_baud && i < sizeof(common) / sizeof(common[0]); i++) {
+        if (common[i] != config->uart.baud_rate)
+            rates[count++] = common[i];
+    }
+    return tuya_mcu_set_baud_probe(mcu->dev, rates, count, 0);
 }
 
 esp_tuya_mcu_handle_t esp_tuya_mcu_init(const tuya_mcu_uart_config_t *config)
 {
+#if !TUYA_MCU_LIGHT_SLEEP
+    if (config->light_sleep) {
+        ESP_LOGE(TAG, "light sleep needs CONFIG_PM_ENABLE and is not supported on ESP8266");
+        return NULL;
+    }
+#endif
     esp_tuya_mcu_t *mcu = calloc(1, sizeof(esp_tuya_mcu_t));
     if (!mcu) {
         ESP_LOGE(TAG, "calloc failed");
@@ -168,14 +772,52 @@ esp_tuya_mcu_handle_t esp_tuya_mcu_init(const tuya_mcu_uart_config_t *config)
         goto err_wifi_state_queue;
     }
 
-    mcu->dp_queue = xQueueCreate(8, sizeof(tuya_dp_t));
+    /* Configs older than the pool leave it zeroed */
+    size_t records = config->dp_pool.records ? config->dp_pool.records : TUYA_MCU_DP_POOL_RECORDS;
+    size_t chunks = config->dp_pool.records ? config->dp_pool.chunks : TUYA_MCU_DP_POOL_CHUNKS;
+    if (tuya_dp_pool_create(&mcu->dp_pool, records, chunks) != 0) {
+        ESP_LOGE(TAG, "create DP pool failed");
+        goto err_dp_pool;
+    }
+
+    mcu->dp_queue = xQueueCreate(TUYA_MCU_DP_QUEUE_SIZE, sizeof(esp_tuya_mcu_dp_write_t));
     if (!mcu->dp_queue) {
         ESP_LOGE(TAG, "create DP queue failed");
         goto err_dp_queue;
     }
 
+    mcu->lock = xSemaphoreCreateMutex();
+    if (!mcu->lock) {
+        ESP_LOGE(TAG, "create lock failed");
+        goto err_lock;
+    }
+
+    if (config->shared_worker) {
+        mcu->worker = shared_worker;
+        if (!mcu->worker) {
+            ESP_LOGE(TAG, "shared worker not started");
+            goto err_worker;
+        }
+    } else {
+        mcu->worker = esp_tuya_mcu_worker_create(1, config->uart.event_queue_size);
+        if (!mcu->worker) {
+            goto err_worker;
+        }
+    }
+
     /* Set attributes */
     mcu->uart_port = config->uart.uart_port;
+    mcu->dp_batch_max = config->dp_batch.max_count;
+    if (mcu->dp_batch_max == 0 || mcu->dp_batch_max > TUYA_MCU_DP_QUEUE_SIZE)
+        mcu->dp_batch_max = TUYA_MCU_DP_QUEUE_SIZE;
+    mcu->dp_batch_delay = pdMS_TO_TICKS(config->dp_batch.max_delay_ms);
+    mcu->dp_event_mode = config->dp_event_mode;
+    mcu->ota.event = TUYA_MCU_EVENT_OTA_PROGRESS;
+    mcu->ota.mcu = mcu;
+    mcu->file.event = TUYA_MCU_EVENT_FILE_PROGRESS;
+    mcu->file.mcu = mcu;
+    mcu->dp_shadow = config->dp_shadow.enable;
+    mcu->skip_duplicates = config->dp_shadow.enable && config->dp_shadow.skip_duplicates;
     /* Install UART driver */
     uart_config_t uart_config = {
         .baud_rate = config->uart.baud_rate,
@@ -187,6 +829,16 @@ esp_tuya_mcu_handle_t esp_tuya_mcu_init(const tuya_mcu_uart_config_t *config)
         .source_clk = UART_SCLK_DEFAULT,
 #endif
     };
+#if TUYA_MCU_LIGHT_SLEEP
+    /* APB clock drops while the chip sleeps, keep the baud rate on a steady clock */
+    if (config->light_sleep) {
+#if SOC_UART_SUPPORT_XTAL_CLK
+        uart_config.source_clk = UART_SCLK_XTAL;
+#elif SOC_UART_SUPPORT_REF_TICK
+        uart_config.source_clk = UART_SCLK_REF_TICK;
+#endif
+    }
+#endif
     if (uart_driver_install(mcu->uart_port, RX_BUFFER_SIZE, TX_BUFFER_SIZE,
                             config->uart.event_queue_size, &mcu->event_queue, 0) != ESP_OK) {
         ESP_LOGE(TAG, "install uart driver failed");
@@ -196,6 +848,15 @@ esp_tuya_mcu_handle_t esp_tuya_mcu_init(const tuya_mcu_uart_config_t *config)
         ESP_LOGE(TAG, "config uart parameter failed");
         goto err_uart_config;
     }
+#if TUYA_MCU_LIGHT_SLEEP
+    if (config->light_sleep &&
+        (uart_set_wakeup_threshold(mcu->uart_port, TUYA_MCU_WAKEUP_EDGES) != ESP_OK ||
+         esp_sleep_enable_uart_wakeup(mcu->uart_port) != ESP_OK ||
+         esp_pm_lock_create(ESP_PM_NO_LIGHT_SLEEP, 0, "tuya_mcu", &mcu->pm_lock) != ESP_OK)) {
+        ESP_LOGE(TAG, "UART wakeup from light sleep setup failed");
+        goto err_uart_config;
+    }
+#endif
 
 #ifndef CONFIG_IDF_TARGET_ESP8266
     if (uart_set_pin(mcu->uart_port, config->uart.tx_pin, config->uart.rx_pin, UART_PIN_NO_CHANGE,
@@ -213,7 +874,52 @@ esp_tuya_mcu_handle_t esp_tuya_mcu_init(const tuya_mcu_uart_config_t *config)
 
     tuya_mcu_set_state_handler(mcu->dev, on_state_changed, mcu);
     tuya_mcu_set_config_handler(mcu->dev, on_config_request, mcu);
-    tuya_mcu_set_dp_handler(mcu->dev, on_dp_received, mcu);
+    tuya_mcu_set_baud_handler(mcu->dev, on_baud_changed, mcu);
+    if (esp_tuya_mcu_start_baud(mcu, config) != 0) {
+        ESP_LOGE(TAG, "set baud rate failed");
+        goto err_eloop;
+    }
+    if (config->fast_start.enable &&
+        tuya_mcu_set_fast_start(mcu->dev, config->fast_start.initial_ms, config->fast_start.max_ms) != 0) {
+        ESP_LOGE(TAG, "invalid fast start intervals");
+        goto err_eloop;
+    }
+    /* Zeroed section keeps the engine defaults, a zero max interval follows the interval */
+    uint32_t hb_max_interval = config->heartbeat.max_interval_ms ? config->heartbeat.max_interval_ms
+                                                                  : config->heartbeat.interval_ms;
+    if (config->heartbeat.interval_ms &&
+        tuya_mcu_set_heartbeat(mcu->dev, config->heartbeat.interval_ms, hb_max_interval, config->heartbeat.max_missed) != 0) {
+        ESP_LOGE(TAG, "invalid heartbeat intervals");
+        goto err_eloop;
+    }
+    if (config->sync_report.window) {
+        if (tuya_mcu_set_sync_window(mcu->dev, config->sync_report.window, config->sync_report.timeout_ms) != 0) {
+            ESP_LOGE(TAG, "invalid sync report window");
+            goto err_eloop;
+        }
+        tuya_mcu_set_sync_report_handler(mcu->dev, on_sync_report, on_sync_report_done, mcu);
+    }
+    /* 0 keeps the engine default */
+    if (config->dp_write.timeout_ms && tuya_mcu_set_dp_write_timeout(mcu->dev, config->dp_write.timeout_ms) != 0) {
+        ESP_LOGE(TAG, "invalid DP write timeout");
+        goto err_eloop;
+    }
+    if (config->stream.max_len)
+        tuya_mcu_set_stream_max_len(mcu->dev, config->stream.max_len);
+    if (mcu->dp_event_mode == TUYA_MCU_DP_EVENT_REF)
+        tuya_mcu_set_dp_batch_handler(mcu->dev, on_dps_received, mcu);
+    else
+        tuya_mcu_set_dp_handler(mcu->dev, on_dp_received, mcu);
+    if (mcu->dp_shadow) {
+        /* The shadow holds its records for good, a pool of its own keeps queued and event DPs flowing */
+        records = config->dp_shadow.records ? config->dp_shadow.records : TUYA_MCU_DP_SHADOW_RECORDS;
+        chunks = config->dp_shadow.records ? config->dp_shadow.chunks : TUYA_MCU_DP_SHADOW_CHUNKS;
+        if (tuya_dp_pool_create(&mcu->shadow_pool, records, chunks) != 0 ||
+            tuya_mcu_enable_shadow(mcu->dev, mcu->shadow_pool) != 0) {
+            ESP_LOGE(TAG, "DP shadow alloc failed");
+            goto err_eloop;
+        }
+    }
 
     /* Create Event loop */
     esp_event_loop_args_t loop_args = { .queue_size = TUYA_MCU_EVENT_LOOP_QUEUE_SIZE,
@@ -222,26 +928,41 @@ esp_tuya_mcu_handle_t esp_tuya_mcu_init(const tuya_mcu_uart_config_t *config)
         ESP_LOGE(TAG, "create event loop failed");
         goto err_eloop;
     }
-    /* Create task */
-    BaseType_t err = xTaskCreate(esp_tuya_mcu_task_entry, "tuya_mcu_task", TUYA_MCU_TASK_STACK_SIZE,
-                                 mcu, TUYA_MCU_TASK_PRIORITY, &mcu->tsk_hdl);
-    if (err != pdTRUE) {
-        ESP_LOGE(TAG, "task create failed");
-        goto err_task_create;
+    /* Hand over to the worker task */
+    esp_err_t err = esp_tuya_mcu_worker_attach(mcu->worker, mcu, config->uart.event_queue_size);
+    if (err == ESP_ERR_NO_MEM) {
+        ESP_LOGE(TAG, "worker serves max %d MCUs with up to %d UART events", mcu->worker->max_instances,
+                 (int)mcu->worker->event_queue_size);
+        goto err_attach;
+    } else if (err != ESP_OK) {
+        ESP_LOGE(TAG, "add UART event queue to worker failed");
+        goto err_attach;
     }
     ESP_LOGI(TAG, "init OK");
     return mcu;
 /*Error Handling*/
-err_task_create:
+err_attach:
     esp_event_loop_delete(mcu->event_loop_hdl);
 err_eloop:
     tuya_mcu_deinit(mcu->dev);
+    tuya_dp_pool_destroy(mcu->shadow_pool);
 err_tuya_mcu:
-err_uart_install:
-    uart_driver_delete(mcu->uart_port);
 err_uart_config:
+#if TUYA_MCU_LIGHT_SLEEP
+    if (mcu->pm_lock)
+        esp_pm_lock_delete(mcu->pm_lock);
+#endif
+    uart_driver_delete(mcu->uart_port);
+err_uart_install:
+    if (mcu->worker != shared_worker)
+        esp_tuya_mcu_worker_destroy(mcu->worker);
+err_worker:
+    vSemaphoreDelete(mcu->lock);
+err_lock:
     vQueueDelete(mcu->dp_queue);
 err_dp_queue:
+    tuya_dp_pool_destroy(mcu->dp_pool);
+err_dp_pool:
     vQueueDelete(mcu->wifi_status_queue);
 err_wifi_state_queue:
 err_malloc:
@@ -249,14 +970,50 @@ err_malloc:
     return NULL;
 }
 
+esp_err_t esp_tuya_mcu_worker_init(const tuya_mcu_worker_config_t *config)
+{
+    if (!config || !config->max_instances || !config->event_queue_size) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (shared_worker) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    shared_worker = esp_tuya_mcu_worker_create(config->max_instances, config->event_queue_size);
+    return shared_worker ? ESP_OK : ESP_ERR_NO_MEM;
+}
+
+esp_err_t esp_tuya_mcu_worker_deinit(void)
+{
+    if (!shared_worker || shared_worker->count) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    esp_tuya_mcu_worker_destroy(shared_worker);
+    shared_worker = NULL;
+    return ESP_OK;
+}
+
 esp_err_t esp_tuya_mcu_deinit(esp_tuya_mcu_handle_t mcu_hdl)
 {
     esp_tuya_mcu_t *mcu = (esp_tuya_mcu_t *)mcu_hdl;
-    vTaskDelete(mcu->tsk_hdl);
+    /* Once detached the worker never touches the MCU again */
+    esp_tuya_mcu_worker_detach(mcu->worker, mcu);
+    if (mcu->worker != shared_worker)
+        esp_tuya_mcu_worker_destroy(mcu->worker);
     esp_event_loop_delete(mcu->event_loop_hdl);
+    tuya_xfer_destroy(mcu->ota.xfer);
+    tuya_xfer_destroy(mcu->file.xfer);
     tuya_mcu_deinit(mcu->dev);
+    tuya_dp_pool_destroy(mcu->shadow_pool);
+#if TUYA_MCU_LIGHT_SLEEP
+    if (mcu->pm_held)
+        esp_pm_lock_release(mcu->pm_lock);
+    if (mcu->pm_lock)
+        esp_pm_lock_delete(mcu->pm_lock);
+#endif
     esp_err_t err = uart_driver_delete(mcu->uart_port);
+    vSemaphoreDelete(mcu->lock);
     vQueueDelete(mcu->dp_queue);
+    tuya_dp_pool_destroy(mcu->dp_pool);
     vQueueDelete(mcu->wifi_status_queue);
     free(mcu);
     return err;
@@ -285,8 +1042,37 @@ esp_err_t esp_tuya_mcu_write_wifi_status(esp_tuya_mcu_handle_t mcu_hdl, uint8_t
     }
     if (xQueueSend(mcu->wifi_status_queue, &status, pdMS_TO_TICKS(100)) != pdTRUE) {
         ESP_LOGE(TAG, "send WiFi status to queue failed");
+        mcu->stats.wifi_queue_full++;
         return ESP_FAIL;
     }
+    xSemaphoreGive(mcu->worker->wake_sem);
+    return ESP_OK;
+}
+
+static esp_err_t esp_tuya_mcu_queue_dp(esp_tuya_mcu_t *mcu, tuya_dp_t *dp, tuya_mcu_dp_write_cb_t cb, void *arg)
+{
+    esp_tuya_mcu_dp_write_t write = { .cb = cb, .arg = arg, .queued = tuya_mcu_get_time_us() };
+
+    write.ref = tuya_dp_pool_alloc_dp(mcu->dp_pool, dp);
+    if (!write.ref) {
+        ESP_LOGE(TAG, "DP pool exhausted");
+        mcu->stats.dp_pool_exhausted++;
+        return ESP_ERR_NO_MEM;
+    }
+    /* Counted before the worker can take it off the queue */
+    xSemaphoreTake(mcu->lock, portMAX_DELAY);
+    mcu->dp_queued[dp->id]++;
+    xSemaphoreGive(mcu->lock);
+    if (xQueueSend(mcu->dp_queue, &write, pdMS_TO_TICKS(100)) != pdTRUE) {
+        ESP_LOGE(TAG, "send DP to queue failed");
+        mcu->stats.dp_queue_full++;
+        xSemaphoreTake(mcu->lock, portMAX_DELAY);
+        mcu->dp_queued[dp->id]--;
+        xSemaphoreGive(mcu->lock);
+        tuya_dp_pool_release(mcu->dp_pool, write.ref);
+        return ESP_FAIL;
+    }
+    xSemaphoreGive(mcu->worker->wake_sem);
     return ESP_OK;
 }
 
@@ -296,9 +1082,318 @@ esp_err_t esp_tuya_mcu_write_dp(esp_tuya_mcu_handle_t mcu_hdl, tuya_dp_t *dp)
     if (!mcu || !dp) {
         return ESP_ERR_INVALID_ARG;
     }
-    if (xQueueSend(mcu->dp_queue, dp, pdMS_TO_TICKS(100)) != pdTRUE) {
-        ESP_LOGE(TAG, "send DP to queue failed");
-        return ESP_FAIL;
+    if (mcu->skip_duplicates) {
+        /* A queued or unechoed write may still change the value */
+        xSemaphoreTake(mcu->lock, portMAX_DELAY);
+        bool duplicate = !mcu->dp_queued[dp->id] && tuya_mcu_dp_matches_shadow(mcu->dev, dp);
+        xSemaphoreGive(mcu->lock);
+        if (duplicate) {
+            ESP_LOGD(TAG, "DP %d unchanged, write skipped", dp->id);
+            return ESP_OK;
+        }
+    }
+    return esp_tuya_mcu_queue_dp(mcu, dp, NULL, NULL);
+}
+
+esp_err_t esp_tuya_mcu_write_dp_async(esp_tuya_mcu_handle_t mcu_hdl, tuya_dp_t *dp, tuya_mcu_dp_write_cb_t cb,
+                                      void *arg)
+{
+    esp_tuya_mcu_t *mcu = (esp_tuya_mcu_t *)mcu_hdl;
+    if (!mcu || !dp) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    /* Always sent, a suppressed duplicate would never be reported back */
+    if (!cb) {
+        return esp_tuya_mcu_queue_dp(mcu, dp, on_dp_write_done, mcu);
+    }
+    return esp_tuya_mcu_queue_dp(mcu, dp, cb, arg);
+}
+
+esp_err_t esp_tuya_mcu_dp_retain(esp_tuya_mcu_handle_t mcu_hdl, tuya_dp_ref_t ref)
+{
+    esp_tuya_mcu_t *mcu = (esp_tuya_mcu_t *)mcu_hdl;
+    if (!mcu || !ref) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    return tuya_dp_pool_retain(mcu->dp_pool, ref) ? ESP_OK : ESP_FAIL;
+}
+
+esp_err_t esp_tuya_mcu_dp_release(esp_tuya_mcu_handle_t mcu_hdl, tuya_dp_ref_t ref)
+{
+    esp_tuya_mcu_t *mcu = (esp_tuya_mcu_t *)mcu_hdl;
+    if (!mcu || !ref) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    tuya_dp_pool_release(mcu->dp_pool, ref);
+    return ESP_OK;
+}
+
+esp_err_t esp_tuya_mcu_complete_sync_report(esp_tuya_mcu_handle_t mcu_hdl, uint16_t id, bool success)
+{
+    esp_tuya_mcu_t *mcu = (esp_tuya_mcu_t *)mcu_hdl;
+    if (!mcu) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    xSemaphoreTake(mcu->lock, portMAX_DELAY);
+    int ret = tuya_mcu_complete_sync_report(mcu->dev, id, success);
+    xSemaphoreGive(mcu->lock);
+    /* Frees a window slot: the DONE event and queued reports must not wait for the next deadline */
+    xSemaphoreGive(mcu->worker->wake_sem);
+    return ret == 0 ? ESP_OK : ESP_ERR_NOT_FOUND;
+}
+
+esp_err_t esp_tuya_mcu_register_cmd_handler(esp_tuya_mcu_handle_t mcu_hdl, uint8_t cmd, tuya_mcu_cmd_handler_t handler,
+                                            void *arg)
+{
+    esp_tuya_mcu_t *mcu = (esp_tuya_mcu_t *)mcu_hdl;
+    if (!mcu) {
+        return ESP_ERR_INVALID_ARG;
     }
+    xSemaphoreTake(mcu->lock, portMAX_DELAY);
+    int ret = tuya_mcu_register_cmd_handler(mcu->dev, cmd, handler, arg);
+    xSemaphoreGive(mcu->lock);
+    return ret == 0 ? ESP_OK : ESP_ERR_NO_MEM;
+}
+
+esp_err_t esp_tuya_mcu_send_frame(esp_tuya_mcu_handle_t mcu_hdl, uint8_t cmd, const uint8_t *data, size_t len)
+{
+    esp_tuya_mcu_t *mcu = (esp_tuya_mcu_t *)mcu_hdl;
+    if (!mcu || (len && !data)) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    xSemaphoreTake(mcu->lock, portMAX_DELAY);
+    int ret = tuya_mcu_send_frame(mcu->dev, cmd, data, len);
+    xSemaphoreGive(mcu->lock);
+    return ret == 0 ? ESP_OK : ESP_FAIL;
+}
+
+esp_err_t esp_tuya_mcu_set_stream_sink(esp_tuya_mcu_handle_t mcu_hdl, tuya_mcu_stream_sink_t sink,
+                                       tuya_mcu_stream_done_t done, void *arg)
+{
+    esp_tuya_mcu_t *mcu = (esp_tuya_mcu_t *)mcu_hdl;
+    if (!mcu) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    xSemaphoreTake(mcu->lock, portMAX_DELAY);
+    tuya_mcu_set_stream_sink(mcu->dev, sink, done, arg);
+    xSemaphoreGive(mcu->lock);
     return ESP_OK;
 }
+
+esp_err_t esp_tuya_mcu_send_stream(esp_tuya_mcu_handle_t mcu_hdl, const tuya_mcu_stream_hdr_t *hdr,
+                                   const uint8_t *data, size_t len, size_t chunk)
+{
+    esp_tuya_mcu_t *mcu = (esp_tuya_mcu_t *)mcu_hdl;
+    if (!mcu || !hdr || (len && !data)) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (chunk == 0) {
+        chunk = TUYA_MCU_STREAM_CHUNK;
+    }
+    tuya_mcu_stream_hdr_t frame = *hdr;
+    size_t                pos = 0;
+    int                   ret;
+    /* Lock held per frame only, the worker keeps serving all its MCUs in between */
+    do {
+        size_t n = len - pos < chunk ? len - pos : chunk;
+        frame.offset = hdr->offset + pos;
+        xSemaphoreTake(mcu->lock, portMAX_DELAY);
+        ret = tuya_mcu_send_stream(mcu->dev, &frame, len ? data + pos : data, n, chunk);
+        xSemaphoreGive(mcu->lock);
+        pos += n;
+    } while (ret >= 0 && pos < len);
+    return ret < 0 ? ESP_FAIL : ESP_OK;
+}
+
+static esp_err_t esp_tuya_mcu_start_xfer(esp_tuya_mcu_t *mcu, esp_tuya_mcu_xfer_t *slot,
+                                         const tuya_xfer_config_t *config, const tuya_xfer_file_t *file)
+{
+    tuya_xfer_config_t xfer_config = *config;
+    esp_err_t          err = ESP_OK;
+
+    xfer_config.progress = on_xfer_progress;
+    xfer_config.progress_arg = slot;
+
+    xSemaphoreTake(mcu->lock, portMAX_DELAY);
+    if (slot->xfer) {
+        err = ESP_ERR_INVALID_STATE;
+    } else {
+        slot->progress = config->progress;
+        slot->progress_arg = config->progress_arg;
+        slot->percent = 0;
+        slot->abort = false;
+        slot->xfer = file ? tuya_xfer_start_file(mcu->dev, &xfer_config, file)
+                          : tuya_xfer_start_ota(mcu->dev, &xfer_config);
+        if (!slot->xfer) {
+            err = ESP_FAIL;
+        }
+    }
+    xSemaphoreGive(mcu->lock);
+    /* Worker sleeps until the deadlines it knew of */
+    xSemaphoreGive(mcu->worker->wake_sem);
+    return err;
+}
+
+esp_err_t esp_tuya_mcu_start_ota(esp_tuya_mcu_handle_t mcu_hdl, const tuya_xfer_config_t *config)
+{
+    esp_tuya_mcu_t *mcu = (esp_tuya_mcu_t *)mcu_hdl;
+    if (!mcu || !config) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    return esp_tuya_mcu_start_xfer(mcu, &mcu->ota, config, NULL);
+}
+
+esp_err_t esp_tuya_mcu_abort_ota(esp_tuya_mcu_handle_t mcu_hdl)
+{
+    esp_tuya_mcu_t *mcu = (esp_tuya_mcu_t *)mcu_hdl;
+    if (!mcu) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    xSemaphoreTake(mcu->lock, portMAX_DELAY);
+    /* Worker fails and frees it on its next pass */
+    mcu->ota.abort = mcu->ota.xfer != NULL;
+    xSemaphoreGive(mcu->lock);
+    xSemaphoreGive(mcu->worker->wake_sem);
+    return ESP_OK;
+}
+
+esp_err_t esp_tuya_mcu_start_file(esp_tuya_mcu_handle_t mcu_hdl, const tuya_xfer_config_t *config,
+                                  const tuya_xfer_file_t *file)
+{
+    esp_tuya_mcu_t *mcu = (esp_tuya_mcu_t *)mcu_hdl;
+    if (!mcu || !config || !file) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    return esp_tuya_mcu_start_xfer(mcu, &mcu->file, config, file);
+}
+
+esp_err_t esp_tuya_mcu_abort_file(esp_tuya_mcu_handle_t mcu_hdl)
+{
+    esp_tuya_mcu_t *mcu = (esp_tuya_mcu_t *)mcu_hdl;
+    if (!mcu) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    xSemaphoreTake(mcu->lock, portMAX_DELAY);
+    mcu->file.abort = mcu->file.xfer != NULL;
+    xSemaphoreGive(mcu->lock);
+    xSemaphoreGive(mcu->worker->wake_sem);
+    return ESP_OK;
+}
+
+esp_err_t esp_tuya_mcu_switch_baud(esp_tuya_mcu_handle_t mcu_hdl, uint32_t baud, uint32_t timeout_ms)
+{
+    esp_tuya_mcu_t *mcu = (esp_tuya_mcu_t *)mcu_hdl;
+    if (!mcu || !baud || !timeout_ms) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    xSemaphoreTake(mcu->lock, portMAX_DELAY);
+    int ret = tuya_mcu_switch_baud(mcu->dev, baud, timeout_ms);
+    xSemaphoreGive(mcu->lock);
+    xSemaphoreGive(mcu->worker->wake_sem);
+    return ret == 0 ? ESP_OK : ESP_ERR_INVALID_STATE;
+}
+
+uint32_t esp_tuya_mcu_get_baud(esp_tuya_mcu_handle_t mcu_hdl)
+{
+    esp_tuya_mcu_t *mcu = (esp_tuya_mcu_t *)mcu_hdl;
+    if (!mcu) {
+        return 0;
+    }
+    xSemaphoreTake(mcu->lock, portMAX_DELAY);
+    uint32_t baud = tuya_mcu_get_baud(mcu->dev);
+    xSemaphoreGive(mcu->lock);
+    return baud;
+}
+
+esp_err_t esp_tuya_mcu_get_product_info(esp_tuya_mcu_handle_t mcu_hdl, tuya_mcu_product_info_t *info)
+{
+    esp_tuya_mcu_t *mcu = (esp_tuya_mcu_t *)mcu_hdl;
+    if (!mcu || !info) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    xSemaphoreTake(mcu->lock, portMAX_DELAY);
+    *info = *tuya_mcu_get_product_info(mcu->dev);
+    xSemaphoreGive(mcu->lock);
+    if (!(info->present & TUYA_MCU_INFO_PID) || !(info->present & TUYA_MCU_INFO_VER)) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    return ESP_OK;
+}
+
+esp_err_t esp_tuya_mcu_get_stats(esp_tuya_mcu_handle_t mcu_hdl, esp_tuya_mcu_stats_t *stats)
+{
+    esp_tuya_mcu_t *mcu = (esp_tuya_mcu_t *)mcu_hdl;
+    if (!mcu || !stats) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    /* Engine counters only change under the lock, the worker's own ones may be a count behind */
+    xSemaphoreTake(mcu->lock, portMAX_DELAY);
+    *stats = mcu->stats;
+    stats->proto = *tuya_mcu_get_stats(mcu->dev);
+    xSemaphoreGive(mcu->lock);
+    return ESP_OK;
+}
+
+esp_err_t esp_tuya_mcu_reset_stats(esp_tuya_mcu_handle_t mcu_hdl)
+{
+    esp_tuya_mcu_t *mcu = (esp_tuya_mcu_t *)mcu_hdl;
+    if (!mcu) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    xSemaphoreTake(mcu->lock, portMAX_DELAY);
+    memset(&mcu->stats, 0, sizeof(mcu->stats));
+    tuya_mcu_reset_stats(mcu->dev);
+    xSemaphoreGive(mcu->lock);
+    return ESP_OK;
+}
+
+esp_err_t esp_tuya_mcu_enable_capture(esp_tuya_mcu_handle_t mcu_hdl, size_t size)
+{
+    esp_tuya_mcu_t *mcu = (esp_tuya_mcu_t *)mcu_hdl;
+    if (!mcu || !size) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    xSemaphoreTake(mcu->lock, portMAX_DELAY);
+    int ret = tuya_mcu_enable_capture(mcu->dev, size);
+    xSemaphoreGive(mcu->lock);
+    return ret == 0 ? ESP_OK : ESP_FAIL;
+}
+
+esp_err_t esp_tuya_mcu_disable_capture(esp_tuya_mcu_handle_t mcu_hdl)
+{
+    esp_tuya_mcu_t *mcu = (esp_tuya_mcu_t *)mcu_hdl;
+    if (!mcu) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    xSemaphoreTake(mcu->lock, portMAX_DELAY);
+    tuya_mcu_disable_capture(mcu->dev);
+    xSemaphoreGive(mcu->lock);
+    return ESP_OK;
+}
+
+esp_err_t esp_tuya_mcu_dump_capture(esp_tuya_mcu_handle_t mcu_hdl, tuya_capture_write_t write, void *arg)
+{
+    esp_tuya_mcu_t *mcu = (esp_tuya_mcu_t *)mcu_hdl;
+    if (!mcu || !write) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    xSemaphoreTake(mcu->lock, portMAX_DELAY);
+    int ret = tuya_mcu_dump_capture(mcu->dev, write, arg);
+    xSemaphoreGive(mcu->lock);
+    return ret == 0 ? ESP_OK : ESP_FAIL;
+}
+
+esp_err_t esp_tuya_mcu_get_dp(esp_tuya_mcu_handle_t mcu_hdl, uint8_t id, tuya_dp_t *dp)
+{
+    esp_tuya_mcu_t *mcu = (esp_tuya_mcu_t *)mcu_hdl;
+    if (!mcu || !dp) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (!mcu->dp_shadow) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    xSemaphoreTake(mcu->lock, portMAX_DELAY);
+    int ret = tuya_mcu_get_dp(mcu->dev, id, dp);
+    xSemaphoreGive(mcu->lock);
+    return ret == 0 ? ESP_OK : ESP_ERR_NOT_FOUND;
+}
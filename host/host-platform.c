@@ -0,0 +1,339 @@
+/*
+ * Copyright (c) 2025 <qb4.dev@gmail.com>
+ *
+ * SPDX-License-Identifier: LGPL-2.1-or-later
+ */
+
+#include "host-platform.h"
+#include "platform.h"
+#include "tuya-defs.h"
+
+#include <stdbool.h>
+#include <string.h>
+#include <time.h>
+
+static bool     tick_manual; // host_tick_set was called
+static uint32_t tick_value;  // Tick set by host_tick_set
+
+struct host_uart {
+    uint8_t          *fifo; // Receive FIFO
+    size_t            size; // FIFO size
+    size_t            head; // Read position
+    size_t            tail; // Write position
+    size_t            used; // Bytes pending in FIFO
+    uint32_t          baud; // Line rate
+    struct host_uart *peer; // Endpoint receiving our writes
+};
+
+static host_uart_t *host_uart_create(size_t fifo_size)
+{
+    host_uart_t *uart = calloc(1, sizeof(host_uart_t));
+    if (!uart)
+        return NULL;
+
+    uart->fifo = malloc(fifo_size);
+    if (!uart->fifo) {
+        free(uart);
+        return NULL;
+    }
+    uart->size = fifo_size;
+    uart->baud = 9600;
+    return uart;
+}
+
+static void host_uart_destroy(host_uart_t *uart)
+{
+    if (!uart)
+        return;
+
+    free(uart->fifo);
+    free(uart);
+}
+
+int host_uart_pair_create(host_uart_t **a, host_uart_t **b, size_t fifo_size)
+{
+    if (!a || !b || !fifo_size)
+        return -1;
+
+    *a = host_uart_create(fifo_size);
+    *b = host_uart_create(fifo_size);
+    if (!*a || !*b) {
+        host_uart_destroy(*a);
+        host_uart_destroy(*b);
+        return -1;
+    }
+    (*a)->peer = *b;
+    (*b)->peer = *a;
+    return 0;
+}
+
+void host_uart_pair_destroy(host_uart_t *a, host_uart_t *b)
+{
+    host_uart_destroy(a);
+    host_uart_destroy(b);
+}
+
+size_t host_uart_write(host_uart_t *uart, const uint8_t *buf, size_t len)
+{
+    host_uart_t *peer = uart->peer;
+    size_t       written = 0;
+
+    while (written < len && peer->used < peer->size) {
+        size_t n = peer->size - peer->tail;
+        if (n > peer->size - peer->used)
+            n = peer->size - peer->used;
+        if (n > len - written)
+            n = len - written;
+
+        memcpy(peer->fifo + peer->tail, buf + written, n);
+        if (uart->baud != peer->baud) {
+            for (size_t i = 0; i < n; i++)
+                peer->fifo[peer->tail + i] ^= 0xA5; // Never a frame header
+        }
+        peer->tail = (peer->tail + n) % peer->size;
+        peer->used += n;
+        written += n;
+    }
+    return written;
+}
+
+size_t host_uart_read(host_uart_t *uart, uint8_t *buf, size_t len)
+{
+    size_t read = 0;
+
+    while (read < len && uart->used > 0) {
+        size_t n = uart->size - uart->head;
+        if (n > uart->used)
+            n = uart->used;
+        if (n > len - read)
+            n = len - read;
+
+        memcpy(buf + read, uart->fifo + uart->head, n);
+        uart->head = (uart->head + n) % uart->size;
+        uart->used -= n;
+        read += n;
+    }
+    return read;
+}
+
+void host_uart_set_baud(host_uart_t *uart, uint32_t baud)
+{
+    uart->baud = baud;
+}
+
+size_t host_uart_pending(const host_uart_t *uart)
+{
+    return uart->used;
+}
+
+void host_uart_flush(host_uart_t *uart)
+{
+    uart->head = 0;
+    uart->tail = 0;
+    uart->used = 0;
+}
+
+static uint8_t host_frame_sum(const uint8_t *buf, size_t len)
+{
+    uint8_t check_sum = 0;
+
+    for (size_t i = 0; i < len; i++)
+        check_sum += buf[i];
+    return check_sum;
+}
+
+size_t host_frame_build(uint8_t *out, uint8_t cmd, const void *data, size_t len)
+{
+    out[HEAD_FIRST] = FRAME_FIRST;
+    out[HEAD_SECOND] = FRAME_SECOND;
+    out[PROTOCOL_VERSION] = HOST_FRAME_VER;
+    out[FRAME_TYPE] = cmd;
+    out[LENGTH_HIGH] = (len >> 8) & 0xFF;
+    out[LENGTH_LOW] = len & 0xFF;
+    memcpy(out + DATA_START, data, len);
+    out[DATA_START + len] = host_frame_sum(out, DATA_START + len);
+    return PROTOCOL_HEAD + len;
+}
+
+size_t host_frame_send(host_uart_t *uart, uint8_t cmd, const void *data, size_t len)
+{
+    uint8_t hdr[DATA_START] = { FRAME_FIRST, FRAME_SECOND, HOST_FRAME_VER, cmd, (len >> 8) & 0xFF, len & 0xFF };
+    uint8_t check_sum = host_frame_sum(hdr, sizeof(hdr)) + host_frame_sum(data, len);
+    size_t  n;
+
+    // Whole header or nothing, a partial frame is left to the caller like a partial write
+    n = host_uart_write(uart, hdr, sizeof(hdr));
+    if (n == sizeof(hdr))
+        n += host_uart_write(uart, data, len);
+    if (n == sizeof(hdr) + len)
+        n += host_uart_write(uart, &check_sum, 1);
+    return n;
+}
+
+int host_frame_next(host_uart_t *uart, host_frame_rx_t *rx, uint8_t *cmd, const uint8_t **data, size_t *len)
+{
+    // Drop what the previous call returned, then top up
+    memmove(rx->buf, rx->buf + rx->used, rx->len - rx->used);
+    rx->len -= rx->used;
+    rx->used = 0;
+    rx->len += host_uart_read(uart, rx->buf + rx->len, sizeof(rx->buf) - rx->len);
+
+    while (rx->len - rx->used >= PROTOCOL_HEAD) {
+        const uint8_t *frame = rx->buf + rx->used;
+        size_t         n = (frame[LENGTH_HIGH] << 8) | frame[LENGTH_LOW];
+        if (frame[HEAD_FIRST] != FRAME_FIRST || frame[HEAD_SECOND] != FRAME_SECOND ||
+            n > sizeof(rx->buf) - PROTOCOL_HEAD) {
+            rx->used++;
+            continue;
+        }
+        if (rx->len - rx->used < PROTOCOL_HEAD + n)
+            break; // Wait for the rest
+        if (host_frame_sum(frame, DATA_START + n) != frame[DATA_START + n]) {
+            rx->used++;
+            continue;
+        }
+        *cmd = frame[FRAME_TYPE];
+        *data = frame + DATA_START;
+        *len = n;
+        rx->used += PROTOCOL_HEAD + n;
+        return 1;
+    }
+    return 0;
+}
+
+int host_mock_init(host_mock_t *mock, host_uart_t **uart, size_t fifo_size)
+{
+    memset(mock, 0, sizeof(*mock));
+    return host_uart_pair_create(uart, &mock->uart, fifo_size);
+}
+
+void host_mock_destroy(host_mock_t *mock, host_uart_t *uart)
+{
+    host_uart_pair_destroy(uart, mock->uart);
+}
+
+void host_mock_reply(host_mock_t *mock, uint8_t cmd, const void *data, size_t len)
+{
+    if (!mock->delay_ms) {
+        host_frame_send(mock->uart, cmd, data, len);
+        return;
+    }
+    if (mock->pending == HOST_MOCK_REPLIES || len > HOST_MOCK_REPLY_MAX)
+        return;
+    mock->replies[mock->pending].due = mock->now + mock->delay_ms;
+    mock->replies[mock->pending].cmd = cmd;
+    mock->replies[mock->pending].len = len;
+    memcpy(mock->replies[mock->pending].data, data, len);
+    mock->pending++;
+}
+
+static void host_mock_handle(host_mock_t *mock, uint8_t cmd, const uint8_t *data, size_t len)
+{
+    static const char    info[] = "{\"p\":\"mockpid\",\"v\":\"1.0.0\",\"m\":0}";
+    static const uint8_t dp[] = { 1, DP_TYPE_BOOL, 0, 1, 1 };
+    uint8_t              beat;
+
+    if (mock->handler && mock->handler(mock, cmd, data, len))
+        return;
+    if (cmd == HEARTBEAT_CMD) {
+        beat = mock->heartbeats++ ? 0x01 : 0x00; // First answer after boot is 0
+        host_mock_reply(mock, HEARTBEAT_CMD, &beat, 1);
+    } else if (cmd == PRODUCT_INFO_CMD) {
+        host_mock_reply(mock, PRODUCT_INFO_CMD, info, sizeof(info) - 1);
+    } else if (cmd == STATE_QUERY_CMD) {
+        host_mock_reply(mock, STATE_UPLOAD_CMD, dp, sizeof(dp));
+    }
+}
+
+void host_mock_step(host_mock_t *mock)
+{
+    static const uint8_t dp[] = { 2, DP_TYPE_VALUE, 0, 4, 0, 0, 0, 42 };
+    const uint8_t       *data;
+    uint8_t              cmd;
+    size_t               len;
+
+    while (host_frame_next(mock->uart, &mock->rx, &cmd, &data, &len)) {
+        if (!mock->silent)
+            host_mock_handle(mock, cmd, data, len);
+    }
+
+    // Answers are queued in due order, the delay is the same for all
+    while (mock->pending && (int32_t)(mock->now - mock->replies[0].due) >= 0) {
+        host_frame_send(mock->uart, mock->replies[0].cmd, mock->replies[0].data, mock->replies[0].len);
+        memmove(mock->replies, mock->replies + 1, --mock->pending * sizeof(mock->replies[0]));
+    }
+
+    if (!mock->silent && mock->report_ms && mock->now - mock->last_report >= mock->report_ms) {
+        host_frame_send(mock->uart, STATE_UPLOAD_CMD, dp, sizeof(dp));
+        mock->last_report = mock->now;
+    }
+}
+
+uint32_t host_mock_clock(void *arg)
+{
+    return ((host_mock_t *)arg)->now;
+}
+
+bool host_mock_run(tuya_mcu_t mcu, host_mock_t *mock, uint32_t limit_ms, bool (*done)(void *arg), void *arg)
+{
+    for (uint32_t end = mock->now + limit_ms; mock->now != end; mock->now++) {
+        if (done && done(arg))
+            return true;
+        tuya_mcu_tick(mcu);
+        host_mock_step(mock);
+    }
+    return !done || done(arg);
+}
+
+void host_tick_set(uint32_t tick)
+{
+    tick_manual = true;
+    tick_value = tick;
+}
+
+uint64_t host_time_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+/* Platform functions */
+int tuya_mcu_uart_rx(void *ctx, uint8_t *c)
+{
+    return (int)host_uart_read((host_uart_t *)ctx, c, 1);
+}
+
+int tuya_mcu_uart_read(void *ctx, uint8_t *buf, size_t len, uint32_t timeout_ms)
+{
+    return (int)host_uart_read((host_uart_t *)ctx, buf, len);
+}
+
+int tuya_mcu_uart_tx(void *ctx, uint8_t c)
+{
+    return host_uart_write((host_uart_t *)ctx, &c, 1) == 1 ? 1 : -1;
+}
+
+int tuya_mcu_uart_write(void *ctx, const uint8_t *buf, size_t len)
+{
+    return (int)host_uart_write((host_uart_t *)ctx, buf, len);
+}
+
+int tuya_mcu_uart_set_baud(void *ctx, uint32_t baud)
+{
+    host_uart_set_baud((host_uart_t *)ctx, baud);
+    return 0;
+}
+
+uint32_t tuya_mcu_get_tick(void)
+{
+    if (tick_manual)
+        return tick_value;
+    return (uint32_t)(host_time_ns() / 1000000ULL);
+}
+
+uint32_t tuya_mcu_get_time_us(void)
+{
+    return (uint32_t)(host_time_ns() / 1000ULL);
+}
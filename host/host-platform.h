@@ -0,0 +1,198 @@
+/*
+ * Copyright (c) 2025 <qb4.dev@gmail.com>
+ *
+ * SPDX-License-Identifier: LGPL-2.1-or-later
+ */
+
+#pragma once
+
+#include <stdlib.h>
+#include <stdbool.h>
+#include <inttypes.h>
+
+#include "tuya-mcu.h"
+
+/**
+ * @brief In-memory UART endpoint
+ *
+ * Endpoints are created in pairs: bytes written to one endpoint can be read
+ * from the other one. The protocol engine gets one endpoint as its uart
+ * context, the other one is driven by a benchmark or a simulated MCU.
+ */
+typedef struct host_uart host_uart_t;
+
+#define HOST_FRAME_VER     0x03 // Protocol version of frames sent by a real MCU
+#define HOST_FRAME_RX_SIZE 2048 // Largest frame host_frame_next takes, header and checksum included
+
+/**
+ * @brief Bytes received by a simulated MCU, cut into frames by host_frame_next
+ */
+typedef struct {
+    uint8_t buf[HOST_FRAME_RX_SIZE];
+    size_t  len;  // Bytes in buf
+    size_t  used; // Bytes of buf already returned or skipped
+} host_frame_rx_t;
+
+/**
+ * @brief Create a connected pair of UART endpoints
+ *
+ * @param a First endpoint
+ * @param b Second endpoint
+ * @param fifo_size Receive FIFO size of each endpoint in bytes
+ * @return int 0 on success, -1 on error
+ */
+int host_uart_pair_create(host_uart_t **a, host_uart_t **b, size_t fifo_size);
+
+/**
+ * @brief Destroy a pair of UART endpoints
+ *
+ * @param a First endpoint
+ * @param b Second endpoint
+ */
+void host_uart_pair_destroy(host_uart_t *a, host_uart_t *b);
+
+/**
+ * @brief Write bytes to the peer of the endpoint
+ *
+ * @return size_t Number of bytes written, less than len if the peer FIFO is full
+ */
+size_t host_uart_write(host_uart_t *uart, const uint8_t *buf, size_t len);
+
+/**
+ * @brief Read bytes received by the endpoint
+ *
+ * @return size_t Number of bytes read, 0 if nothing is pending
+ */
+size_t host_uart_read(host_uart_t *uart, uint8_t *buf, size_t len);
+
+/**
+ * @brief Set the baud rate of the endpoint
+ *
+ * Endpoints start at 9600. Bytes written while the two ends disagree arrive
+ * garbled, the way a real receiver sees a wrong rate.
+ */
+void host_uart_set_baud(host_uart_t *uart, uint32_t baud);
+
+/**
+ * @brief Number of bytes received by the endpoint and not read yet
+ */
+size_t host_uart_pending(const host_uart_t *uart);
+
+/**
+ * @brief Drop all bytes received by the endpoint
+ */
+void host_uart_flush(host_uart_t *uart);
+
+/**
+ * @brief Build a frame the way the MCU sends it
+ *
+ * @param out Buffer of at least PROTOCOL_HEAD + len bytes
+ * @return size_t Frame length
+ */
+size_t host_frame_build(uint8_t *out, uint8_t cmd, const void *data, size_t len);
+
+/**
+ * @brief Send a frame the way the MCU sends it to the peer of the endpoint
+ *
+ * @return size_t Number of bytes written, less than the frame if the peer FIFO is full
+ */
+size_t host_frame_send(host_uart_t *uart, uint8_t cmd, const void *data, size_t len);
+
+/**
+ * @brief Take the next whole frame received by the endpoint
+ *
+ * Reads whatever is pending into rx and returns frames one by one. Bytes that
+ * do not start a frame with a valid checksum are skipped, so a garbled line
+ * resynchronises on the next header. Data stays valid until the next call.
+ *
+ * @param cmd Command of the frame
+ * @param data Data of the frame
+ * @param len Data length
+ * @return int 1 if a frame was returned, 0 if no whole frame is pending
+ */
+int host_frame_next(host_uart_t *uart, host_frame_rx_t *rx, uint8_t *cmd, const uint8_t **data, size_t *len);
+
+#define HOST_MOCK_REPLIES   16 // Delayed answers a scripted MCU keeps queued
+#define HOST_MOCK_REPLY_MAX 48 // Largest delayed answer
+
+typedef struct host_mock host_mock_t;
+
+/* Scenario hook, runs for every frame before the default answers; true if it took care of the frame */
+typedef bool (*host_mock_handler_t)(host_mock_t *mock, uint8_t cmd, const uint8_t *data, size_t len);
+
+/**
+ * @brief Scripted MCU on a simulated clock
+ *
+ * Answers heartbeats (0x00 first after boot, 0x01 afterwards), the product
+ * information query and the state query like a real MCU. Tests script a
+ * scenario through the fields below and the handler hook.
+ */
+struct host_mock {
+    host_uart_t        *uart;        // Endpoint of the MCU
+    host_frame_rx_t     rx;          // Frames from the engine
+    uint32_t            now;         // Simulated clock, feed it to the engine with host_mock_clock
+    bool                silent;      // Ignore every frame
+    uint32_t            delay_ms;    // Answer latency, 0 answers at once
+    unsigned            heartbeats;  // Heartbeats answered since boot, set to 0 to reboot the MCU
+    uint32_t            report_ms;   // Unsolicited DP report period, 0 none
+    uint32_t            last_report; // Last unsolicited DP report
+    host_mock_handler_t handler;     // Scenario hook, may be NULL
+    void               *arg;         // Argument for the hook
+    struct {
+        uint32_t due;
+        uint8_t  cmd;
+        uint8_t  len;
+        uint8_t  data[HOST_MOCK_REPLY_MAX];
+    } replies[HOST_MOCK_REPLIES]; // Answers waiting for delay_ms, in due order
+    unsigned pending;             // Answers queued
+};
+
+/**
+ * @brief Reset a scripted MCU and connect it to a new UART pair
+ *
+ * @param uart Endpoint for the engine
+ * @param fifo_size Receive FIFO size of each endpoint in bytes
+ * @return int 0 on success, -1 on error
+ */
+int host_mock_init(host_mock_t *mock, host_uart_t **uart, size_t fifo_size);
+
+/**
+ * @brief Disconnect a scripted MCU from the engine endpoint
+ */
+void host_mock_destroy(host_mock_t *mock, host_uart_t *uart);
+
+/**
+ * @brief Answer the engine, after delay_ms
+ */
+void host_mock_reply(host_mock_t *mock, uint8_t cmd, const void *data, size_t len);
+
+/**
+ * @brief Handle every frame received and send the answers and reports that are due
+ */
+void host_mock_step(host_mock_t *mock);
+
+/**
+ * @brief Clock of the scripted MCU, for tuya_mcu_set_clock
+ */
+uint32_t host_mock_clock(void *arg);
+
+/**
+ * @brief Tick the engine and step the MCU once per simulated millisecond
+ *
+ * @param limit_ms Simulated time to give up after
+ * @param done Checked before every step, NULL runs for limit_ms
+ * @return bool True once done returns true, always true without done
+ */
+bool host_mock_run(tuya_mcu_t mcu, host_mock_t *mock, uint32_t limit_ms, bool (*done)(void *arg), void *arg);
+
+/**
+ * @brief Drive tuya_mcu_get_tick by hand from now on, for replays
+ *
+ * @param tick Value returned by tuya_mcu_get_tick until the next call
+ */
+void host_tick_set(uint32_t tick);
+
+/**
+ * @brief Monotonic time in nanoseconds, for benchmarks
+ */
+uint64_t host_time_ns(void);
@@ -0,0 +1,134 @@
+/*
+ * Copyright (c) 2025 <qb4.dev@gmail.com>
+ *
+ * SPDX-License-Identifier: LGPL-2.1-or-later
+ */
+
+/*
+ * Baud rate probing and switching test
+ *
+ * A mock MCU listens at a fixed rate and answers heartbeats and the product
+ * information query. The engine has to find that rate by probing, or follow
+ * the mock to a faster rate and come back when the mock does not move.
+ */
+
+#include "host-platform.h"
+#include "platform.h"
+#include "tuya-mcu.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#define FIFO_SIZE      4096
+#define RUN_TIMEOUT_MS 5000
+
+static const uint32_t rates[] = { 9600, 19200, 38400, 57600, 115200 };
+
+struct baud_result {
+    uint32_t baud;  // Rate reported to the handler
+    bool     ok;    // Locked or switch confirmed
+    unsigned calls; // Handler calls
+};
+
+static void on_baud(tuya_mcu_t mcu, uint32_t baud, bool ok, void *arg)
+{
+    struct baud_result *result = arg;
+
+    result->baud = baud;
+    result->ok = ok;
+    result->calls++;
+}
+
+static bool baud_reported(void *arg)
+{
+    return ((struct baud_result *)arg)->calls > 0;
+}
+
+static bool link_up(void *arg)
+{
+    return ((host_mock_t *)arg)->heartbeats >= 2;
+}
+
+static int run_probe(uint32_t mcu_baud)
+{
+    static host_mock_t mock;
+    struct baud_result result = { 0 };
+    host_uart_t       *uart;
+    tuya_mcu_t         mcu;
+    int                ret = -1;
+
+    if (host_mock_init(&mock, &uart, FIFO_SIZE) != 0 || tuya_mcu_init(&mcu, uart) != 0)
+        return -1;
+    tuya_mcu_set_clock(mcu, host_mock_clock, &mock);
+    host_uart_set_baud(mock.uart, mcu_baud);
+    tuya_mcu_set_baud_handler(mcu, on_baud, &result);
+
+    if (tuya_mcu_set_baud_probe(mcu, rates, sizeof(rates) / sizeof(rates[0]), 20) != 0 ||
+        !host_mock_run(mcu, &mock, RUN_TIMEOUT_MS, baud_reported, &result))
+        goto out;
+    uint32_t locked = mock.now;
+    printf("probe  %6u: locked at %6u after %3u ms\n", mcu_baud, result.baud, locked);
+    if (result.ok && result.baud == mcu_baud && tuya_mcu_get_baud(mcu) == mcu_baud)
+        ret = 0;
+out:
+    tuya_mcu_deinit(mcu);
+    host_mock_destroy(&mock, uart);
+    return ret;
+}
+
+static int run_switch(bool mcu_follows)
+{
+    static host_mock_t mock;
+    struct baud_result result = { 0 };
+    host_uart_t       *uart;
+    tuya_mcu_t         mcu;
+    int                ret = -1;
+
+    if (host_mock_init(&mock, &uart, FIFO_SIZE) != 0 || tuya_mcu_init(&mcu, uart) != 0)
+        return -1;
+    tuya_mcu_set_clock(mcu, host_mock_clock, &mock);
+    tuya_mcu_set_baud_handler(mcu, on_baud, &result);
+
+    // Rate known up front, bring the link up at it
+    if (tuya_mcu_set_baud_probe(mcu, rates, 1, 0) != 0)
+        goto out;
+    host_mock_run(mcu, &mock, RUN_TIMEOUT_MS, link_up, &mock);
+    host_mock_run(mcu, &mock, 1, NULL, NULL); // Engine takes the last answer at the old rate
+
+    // Both sides agreed on 115200, the MCU moves a little later than us
+    if (tuya_mcu_switch_baud(mcu, 115200, 200) != 0)
+        goto out;
+    if (mcu_follows) {
+        host_mock_run(mcu, &mock, 30, NULL, NULL);
+        host_uart_set_baud(mock.uart, 115200);
+    }
+    if (!host_mock_run(mcu, &mock, RUN_TIMEOUT_MS, baud_reported, &result))
+        goto out;
+    printf("switch %s: %s, at %6u\n", mcu_follows ? "followed" : "refused ", result.ok ? "confirmed" : "reverted",
+           tuya_mcu_get_baud(mcu));
+
+    // Link must still work at whatever rate we ended on
+    host_mock_run(mcu, &mock, 1, NULL, NULL);
+    unsigned heartbeats = mock.heartbeats;
+    if (tuya_mcu_send_frame(mcu, HEARTBEAT_CMD, NULL, 0) != 0)
+        goto out;
+    host_mock_run(mcu, &mock, 1, NULL, NULL);
+    if (result.ok == mcu_follows && result.baud == 115200 && tuya_mcu_get_baud(mcu) == (mcu_follows ? 115200 : 9600) &&
+        mock.heartbeats == heartbeats + 1)
+        ret = 0;
+out:
+    tuya_mcu_deinit(mcu);
+    host_mock_destroy(&mock, uart);
+    return ret;
+}
+
+int main(void)
+{
+    int failed = 0;
+
+    for (size_t i = 0; i < sizeof(rates) / sizeof(rates[0]); i++)
+        failed |= run_probe(rates[i]);
+    failed |= run_switch(true);
+    failed |= run_switch(false);
+    return failed ? 1 : 0;
+}
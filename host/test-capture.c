@@ -0,0 +1,185 @@
+/*
+ * Copyright (c) 2025 <qb4.dev@gmail.com>
+ *
+ * SPDX-License-Identifier: LGPL-2.1-or-later
+ */
+
+/*
+ * Frame capture test
+ *
+ * Checks that the capture ring drops its oldest records first and truncates
+ * records larger than itself, then captures noisy traffic on one engine and
+ * replays it into a fresh one, which has to end up with the same counters.
+ */
+
+#include "host-platform.h"
+#include "tuya-mcu.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#define FIFO_SIZE    4096
+#define CAPTURE_SIZE (16 * 1024)
+
+struct dump_buf {
+    uint8_t data[CAPTURE_SIZE + TUYA_CAPTURE_FILE_HDR];
+    size_t  len;
+};
+
+static int dump_write(void *arg, const uint8_t *data, size_t len)
+{
+    struct dump_buf *dump = arg;
+
+    if (len > sizeof(dump->data) - dump->len)
+        return -1;
+    memcpy(dump->data + dump->len, data, len);
+    dump->len += len;
+    return 0;
+}
+
+static int test_ring(void)
+{
+    static struct dump_buf dump;
+    tuya_capture_t         cap;
+    tuya_capture_rec_t     rec;
+    uint8_t                data[100];
+    size_t                 pos;
+    int                    ret = -1;
+
+    if (tuya_capture_create(&cap, 64) != 0)
+        return -1;
+
+    // 27 bytes per record, only the last two fit
+    for (uint8_t i = 0; i < 5; i++) {
+        memset(data, i, 20);
+        tuya_capture_begin(cap, 1000 + i, 0, 20);
+        tuya_capture_append(cap, data, 10);
+        tuya_capture_append(cap, data + 10, 10);
+    }
+    dump.len = 0;
+    if (tuya_capture_dump(cap, dump_write, &dump) != 0 || tuya_capture_open(dump.data, dump.len, &pos) != 0)
+        goto out;
+    for (uint8_t i = 3; i < 5; i++) {
+        if (tuya_capture_next(dump.data, dump.len, &pos, &rec) != 1 || rec.tick != 1000u + i || rec.len != 20 ||
+            rec.data[0] != i || rec.data[19] != i)
+            goto out;
+    }
+    if (tuya_capture_next(dump.data, dump.len, &pos, &rec) != 0)
+        goto out;
+
+    // Larger than the ring: kept alone and cut
+    memset(data, 0xAB, sizeof(data));
+    tuya_capture_begin(cap, 2000, TUYA_CAPTURE_TX, sizeof(data));
+    tuya_capture_append(cap, data, sizeof(data));
+    dump.len = 0;
+    if (tuya_capture_dump(cap, dump_write, &dump) != 0 || tuya_capture_open(dump.data, dump.len, &pos) != 0 ||
+        tuya_capture_next(dump.data, dump.len, &pos, &rec) != 1 || rec.len != 64 - TUYA_CAPTURE_REC_HDR ||
+        rec.flags != (TUYA_CAPTURE_TX | TUYA_CAPTURE_TRUNCATED) || tuya_capture_next(dump.data, dump.len, &pos, &rec))
+        goto out;
+    ret = 0;
+out:
+    printf("ring        %s\n", ret ? "FAILED" : "ok");
+    tuya_capture_destroy(cap);
+    return ret;
+}
+
+static int on_dps(tuya_mcu_t mcu, const uint8_t *dps, size_t len, void *arg)
+{
+    tuya_dp_iter_t it;
+    tuya_dp_view_t view;
+
+    tuya_dp_iter_init(&it, dps, len);
+    while (tuya_dp_iter_next(&it, &view) > 0)
+        (*(unsigned *)arg)++;
+    return 0;
+}
+
+/* Heartbeat answers and DP reports mixed with noise and broken frames, split at odd places */
+static void send_traffic(tuya_mcu_t mcu, host_uart_t *peer, uint32_t *tick)
+{
+    static const uint8_t noise[] = { 0x00, 0x55, 0x13, 0xAA, 0x55, 0x55 };
+    uint8_t              frame[64], beat = 1;
+    uint8_t              dps[] = { 1, DP_TYPE_BOOL, 0, 1, 0, 2, DP_TYPE_VALUE, 0, 4, 0, 0, 0, 0 };
+    size_t               len;
+
+    for (unsigned i = 0; i < 200; i++) {
+        host_tick_set(*tick += 37);
+        dps[4] = i & 1;
+        dps[12] = i;
+        len = i % 3 ? host_frame_build(frame, STATE_UPLOAD_CMD, dps, sizeof(dps))
+                    : host_frame_build(frame, HEARTBEAT_CMD, &beat, 1);
+        if (i % 7 == 0)
+            frame[len - 1]++; // Bad checksum
+        if (i % 5 == 0)
+            host_uart_write(peer, noise, sizeof(noise));
+        host_uart_write(peer, frame, i % 4);
+        tuya_mcu_tick(mcu);
+        host_uart_write(peer, frame + i % 4, len - i % 4);
+        tuya_mcu_tick(mcu);
+        host_uart_flush(peer);
+    }
+}
+
+static int test_replay(void)
+{
+    static struct dump_buf dump;
+    host_uart_t           *uart[2], *peer[2];
+    tuya_mcu_t             mcu[2];
+    unsigned               dp_count[2] = { 0 };
+    tuya_capture_rec_t     rec;
+    size_t                 pos;
+    uint32_t               tick = 100000, tx_frames = 0, tx_records = 0;
+    int                    ret = -1;
+
+    for (int i = 0; i < 2; i++) {
+        if (host_uart_pair_create(&uart[i], &peer[i], FIFO_SIZE) != 0 || tuya_mcu_init(&mcu[i], uart[i]) != 0)
+            return -1;
+        tuya_mcu_set_dp_batch_handler(mcu[i], on_dps, &dp_count[i]);
+    }
+
+    // Live traffic on the first engine
+    if (tuya_mcu_enable_capture(mcu[0], CAPTURE_SIZE) != 0)
+        goto out;
+    send_traffic(mcu[0], peer[0], &tick);
+    dump.len = 0;
+    if (tuya_mcu_dump_capture(mcu[0], dump_write, &dump) != 0 || tuya_capture_open(dump.data, dump.len, &pos) != 0)
+        goto out;
+
+    // Replay into the second one
+    while (tuya_capture_next(dump.data, dump.len, &pos, &rec) > 0) {
+        host_tick_set(rec.tick);
+        if (rec.flags & TUYA_CAPTURE_TX) {
+            tx_records++;
+            continue;
+        }
+        host_uart_write(peer[1], rec.data, rec.len);
+        tuya_mcu_tick(mcu[1]);
+        host_uart_flush(peer[1]);
+    }
+
+    const tuya_mcu_stats_t *live = tuya_mcu_get_stats(mcu[0]), *replayed = tuya_mcu_get_stats(mcu[1]);
+    for (int i = 0; i <= TUYA_MCU_STATS_CMDS; i++)
+        tx_frames += live->tx[i].frames;
+    printf("replay      %u DPs, %" PRIu32 " checksum errors, %" PRIu32 " bytes discarded, %" PRIu32
+           " tx frames captured\n",
+           dp_count[1], replayed->rx_checksum_errors, replayed->rx_discarded, tx_records);
+    if (!memcmp(live->rx, replayed->rx, sizeof(live->rx)) && live->rx_checksum_errors == replayed->rx_checksum_errors &&
+        live->rx_discarded == replayed->rx_discarded && dp_count[0] == dp_count[1] && dp_count[0] > 0 &&
+        live->rx_checksum_errors > 0 && tx_records == tx_frames && tx_frames > 0)
+        ret = 0;
+out:
+    for (int i = 0; i < 2; i++) {
+        tuya_mcu_deinit(mcu[i]);
+        host_uart_pair_destroy(uart[i], peer[i]);
+    }
+    return ret;
+}
+
+int main(void)
+{
+    int failed = 0;
+
+    failed |= test_ring();
+    failed |= test_replay();
+    return failed ? 1 : 0;
+}
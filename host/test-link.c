@@ -0,0 +1,262 @@
+/*
+ * Copyright (c) 2025 <qb4.dev@gmail.com>
+ *
+ * SPDX-License-Identifier: LGPL-2.1-or-later
+ */
+
+/*
+ * Link monitor test
+ *
+ * A mock MCU on a simulated clock goes silent, reboots or keeps reporting
+ * DPs. The engine has to restart the handshake when heartbeats go
+ * unanswered or come back as 0x00, get initialized again once the MCU is
+ * back, and skip heartbeats while DP reports prove the link is alive. The
+ * same has to work when the engine is only ticked at tuya_mcu_next_deadline,
+ * and heartbeats must stay one per interval when answers are not awaited.
+ */
+
+#include "host-platform.h"
+#include "tuya-mcu.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#define FIFO_SIZE 4096
+
+struct link_result {
+    enum tuya_mcu_state state;   // Last state entered
+    uint32_t            changed; // When it was entered
+    enum tuya_mcu_state wait;    // State run_until waits for
+};
+
+static int on_state(tuya_mcu_t mcu, enum tuya_mcu_state st, void *arg)
+{
+    struct link_result *res = arg;
+
+    res->state = st;
+    res->changed = tuya_mcu_now(mcu);
+    return 0;
+}
+
+static bool state_entered(void *arg)
+{
+    struct link_result *res = arg;
+
+    return res->state == res->wait;
+}
+
+/* Run until state is entered, false after limit_ms */
+static bool run_until(tuya_mcu_t mcu, host_mock_t *mock, struct link_result *res, enum tuya_mcu_state state,
+                      uint32_t limit_ms)
+{
+    res->wait = state;
+    return host_mock_run(mcu, mock, limit_ms, state_entered, res);
+}
+
+/*
+ * Tick only when the engine asks for it or the mock has sent something, like a
+ * worker sleeping on tuya_mcu_next_deadline. Returns the ticks spent, 0 if the
+ * engine kept asking for another tick at the same time.
+ */
+static unsigned run_tickless(tuya_mcu_t mcu, host_uart_t *uart, host_mock_t *mock, struct link_result *res,
+                             enum tuya_mcu_state state, uint32_t limit_ms)
+{
+    uint32_t end = mock->now + limit_ms, wait;
+    unsigned ticks = 0, again = 0;
+
+    while (res->state != state && mock->now != end) {
+        tuya_mcu_tick(mcu);
+        ticks++;
+        host_mock_step(mock);
+        if (host_uart_pending(uart))
+            continue; // Woken by UART data
+        wait = tuya_mcu_next_deadline(mcu);
+        if (wait == 0) {
+            if (++again > 3)
+                return 0;
+            continue;
+        }
+        again = 0;
+        if (mock->report_ms && mock->last_report + mock->report_ms - mock->now < wait)
+            wait = mock->last_report + mock->report_ms - mock->now;
+        mock->now += wait < end - mock->now ? wait : end - mock->now;
+    }
+    return ticks;
+}
+
+static int setup(tuya_mcu_t *mcu, host_uart_t **uart, host_mock_t *mock, struct link_result *res)
+{
+    memset(res, 0, sizeof(*res));
+    if (host_mock_init(mock, uart, FIFO_SIZE) != 0 || tuya_mcu_init(mcu, *uart) != 0)
+        return -1;
+    tuya_mcu_set_clock(*mcu, host_mock_clock, mock);
+    tuya_mcu_set_state_handler(*mcu, on_state, res);
+    tuya_mcu_set_fast_start(*mcu, TUYA_MCU_FAST_START_INITIAL, TUYA_MCU_FAST_START_MAX);
+    return run_until(*mcu, mock, res, TUYA_MCU_INITIALIZED, 1000) ? 0 : -1;
+}
+
+static int test_lost(void)
+{
+    static host_mock_t mock;
+    struct link_result res;
+    host_uart_t       *uart;
+    tuya_mcu_t         mcu;
+    int                ret = -1;
+
+    if (setup(&mcu, &uart, &mock, &res) != 0)
+        goto out;
+
+    // Silent MCU: heartbeat after the interval, then one retry per reply timeout
+    uint32_t silent_at = mock.now;
+    mock.silent = true;
+    if (!run_until(mcu, &mock, &res, TUYA_MCU_INIT_HEARTBEAT, 30000))
+        goto out;
+    uint32_t detected = res.changed - silent_at;
+    mock.silent = false;
+    if (!run_until(mcu, &mock, &res, TUYA_MCU_INITIALIZED, 5000))
+        goto out;
+
+    const tuya_mcu_stats_t *stats = tuya_mcu_get_stats(mcu);
+    printf("lost        detected after %5u ms, %u missed, back after %u ms\n", detected, stats->heartbeats_missed,
+           res.changed - silent_at - detected);
+    if (stats->heartbeats_missed == TUYA_MCU_HEARTBEAT_MAX_MISSED && stats->resyncs == 1 &&
+        detected <= TUYA_MCU_HEARTBEAT_INTERVAL + TUYA_MCU_HEARTBEAT_MAX_MISSED * 1000 + 10)
+        ret = 0;
+out:
+    tuya_mcu_deinit(mcu);
+    host_mock_destroy(&mock, uart);
+    return ret;
+}
+
+static int test_reboot(void)
+{
+    static host_mock_t mock;
+    struct link_result res;
+    host_uart_t       *uart;
+    tuya_mcu_t         mcu;
+    int                ret = -1;
+
+    if (setup(&mcu, &uart, &mock, &res) != 0)
+        goto out;
+
+    // Rebooted MCU answers the next heartbeat with 0x00
+    uint32_t reboot_at = mock.now;
+    mock.heartbeats = 0;
+    if (!run_until(mcu, &mock, &res, TUYA_MCU_INIT_HEARTBEAT, 30000))
+        goto out;
+    uint32_t detected = res.changed - reboot_at;
+    if (!run_until(mcu, &mock, &res, TUYA_MCU_INITIALIZED, 5000))
+        goto out;
+
+    const tuya_mcu_stats_t *stats = tuya_mcu_get_stats(mcu);
+    printf("reboot      detected after %5u ms, %u missed, back after %u ms\n", detected, stats->heartbeats_missed,
+           res.changed - reboot_at - detected);
+    if (stats->heartbeats_missed == 0 && stats->resyncs == 1)
+        ret = 0;
+out:
+    tuya_mcu_deinit(mcu);
+    host_mock_destroy(&mock, uart);
+    return ret;
+}
+
+static int test_adaptive(uint32_t report_ms, uint32_t max_beats)
+{
+    static host_mock_t mock;
+    struct link_result res;
+    host_uart_t       *uart;
+    tuya_mcu_t         mcu;
+    int                ret = -1;
+
+    if (setup(&mcu, &uart, &mock, &res) != 0 || tuya_mcu_set_heartbeat(mcu, 5000, 60000, 3) != 0)
+        goto out;
+
+    uint32_t before = tuya_mcu_get_stats(mcu)->tx[HEARTBEAT_CMD].frames;
+    mock.report_ms = report_ms;
+    host_mock_run(mcu, &mock, 120000, NULL, NULL);
+    uint32_t beats = tuya_mcu_get_stats(mcu)->tx[HEARTBEAT_CMD].frames - before;
+    printf("adaptive    reports every %5u ms: %2u heartbeats in 120 s\n", report_ms, beats);
+    if (res.state == TUYA_MCU_INITIALIZED && beats <= max_beats && tuya_mcu_get_stats(mcu)->resyncs == 0)
+        ret = 0;
+out:
+    tuya_mcu_deinit(mcu);
+    host_mock_destroy(&mock, uart);
+    return ret;
+}
+
+/* Unanswered heartbeats never restart the handshake, they still go out once per interval */
+static int test_unmonitored(void)
+{
+    static host_mock_t mock;
+    struct link_result res;
+    host_uart_t       *uart;
+    tuya_mcu_t         mcu;
+    unsigned           ticks;
+    int                ret = -1;
+
+    if (setup(&mcu, &uart, &mock, &res) != 0 ||
+        tuya_mcu_set_heartbeat(mcu, TUYA_MCU_HEARTBEAT_INTERVAL, TUYA_MCU_HEARTBEAT_INTERVAL, 0) != 0)
+        goto out;
+
+    uint32_t before = tuya_mcu_get_stats(mcu)->tx[HEARTBEAT_CMD].frames;
+    mock.silent = true;
+    ticks = run_tickless(mcu, uart, &mock, &res, TUYA_MCU_INIT_HEARTBEAT, 4 * TUYA_MCU_HEARTBEAT_INTERVAL);
+    host_mock_run(mcu, &mock, 4 * TUYA_MCU_HEARTBEAT_INTERVAL, NULL, NULL);
+    uint32_t beats = tuya_mcu_get_stats(mcu)->tx[HEARTBEAT_CMD].frames - before;
+    printf("unmonitored %u heartbeats in %u s, %u ticks\n", beats, 8 * TUYA_MCU_HEARTBEAT_INTERVAL / 1000, ticks);
+    if (ticks && ticks < 16 && beats <= 8 && res.state == TUYA_MCU_INITIALIZED &&
+        tuya_mcu_get_stats(mcu)->resyncs == 0)
+        ret = 0;
+out:
+    tuya_mcu_deinit(mcu);
+    host_mock_destroy(&mock, uart);
+    return ret;
+}
+
+static int test_tickless(void)
+{
+    static host_mock_t mock;
+    struct link_result res;
+    host_uart_t       *uart;
+    tuya_mcu_t         mcu;
+    unsigned           lost_ticks, back_ticks, idle_ticks;
+    int                ret = -1;
+
+    if (setup(&mcu, &uart, &mock, &res) != 0)
+        goto out;
+
+    // Same loss as test_lost, ticked only at deadlines
+    uint32_t silent_at = mock.now;
+    mock.silent = true;
+    lost_ticks = run_tickless(mcu, uart, &mock, &res, TUYA_MCU_INIT_HEARTBEAT, 30000);
+    uint32_t detected = res.changed - silent_at;
+    mock.silent = false;
+    back_ticks = run_tickless(mcu, uart, &mock, &res, TUYA_MCU_INITIALIZED, 5000);
+
+    // Idle link with DP reports every 10 s
+    mock.report_ms = 10000;
+    mock.last_report = mock.now;
+    idle_ticks = run_tickless(mcu, uart, &mock, &res, TUYA_MCU_INIT_HEARTBEAT, 120000);
+    printf("tickless    detected after %5u ms in %u ticks, back in %u ticks, %u ticks idle for 120 s\n", detected,
+           lost_ticks, back_ticks, idle_ticks);
+    if (lost_ticks && back_ticks && idle_ticks && res.state == TUYA_MCU_INITIALIZED &&
+        detected == TUYA_MCU_HEARTBEAT_INTERVAL + TUYA_MCU_HEARTBEAT_MAX_MISSED * 1000 && lost_ticks < 16 &&
+        idle_ticks < 64)
+        ret = 0;
+out:
+    tuya_mcu_deinit(mcu);
+    host_mock_destroy(&mock, uart);
+    return ret;
+}
+
+int main(void)
+{
+    int failed = 0;
+
+    failed |= test_lost();
+    failed |= test_reboot();
+    failed |= test_adaptive(0, 24);
+    failed |= test_adaptive(1000, 2);
+    failed |= test_unmonitored();
+    failed |= test_tickless();
+    return failed ? 1 : 0;
+}
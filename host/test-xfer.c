@@ -0,0 +1,294 @@
+/*
+ * Copyright (c) 2025 <qb4.dev@gmail.com>
+ *
+ * SPDX-License-Identifier: LGPL-2.1-or-later
+ */
+
+/*
+ * MCU firmware upgrade and file download test
+ *
+ * Pushes an image with tuya_xfer_start_ota / tuya_xfer_start_file over an
+ * in-memory UART link to a mock MCU that answers the start command with its
+ * packet size and acks every packet. The mock can lose packets, refuse them,
+ * ack them later than the transfer timeout or stop answering for a while.
+ */
+
+#include "host-platform.h"
+#include "platform.h"
+#include "tuya-defs.h"
+#include "tuya-mcu.h"
+#include "tuya-xfer.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define FIFO_SIZE (64 * 1024)
+#define IMAGE_SIZE (64 * 1024 + 123)
+#define RUN_TIMEOUT_MS 10000
+#define ACK_QUEUE 64
+
+struct mock_mcu {
+    host_uart_t    *uart;
+    host_frame_rx_t rx;
+    bool            file;        // File download instead of firmware upgrade
+    int             start_reply; // Packet size code sent back, -1 for an empty reply
+    unsigned        drop_every;  // Lose every nth data packet, 0 keeps all
+    unsigned        nack_every;  // Refuse every nth data packet, file download only
+    unsigned        outage_at;   // Stop answering after this many data packets, 0 never
+    unsigned        outage_len;  // Frames ignored during the outage
+    uint32_t        ack_delay;   // ms before a packet is acked
+    uint32_t        ack_due[ACK_QUEUE];
+    uint8_t         ack_status[ACK_QUEUE];
+    unsigned        ack_head;    // Oldest delayed ack
+    unsigned        ack_count;   // Delayed acks queued
+    unsigned        packets;     // Data packets seen
+    unsigned        starts;      // Start commands seen
+    uint32_t        first;       // Lowest offset written
+    uint32_t        size;        // Size from the start command
+    bool            end;         // Closing packet seen
+    bool            complete;    // Whole image was in when the closing packet came
+    uint8_t         image[IMAGE_SIZE];
+};
+
+struct run_params {
+    const char *name;
+    bool        file;
+    uint8_t     window;
+    int         start_reply;
+    unsigned    drop_every;
+    unsigned    nack_every;
+    unsigned    outage_at;
+    unsigned    outage_len;
+    uint32_t    ack_delay;
+    uint8_t     resumes;
+    uint32_t    offset;
+    unsigned    starts; // Start commands expected
+};
+
+static uint8_t image[IMAGE_SIZE];
+
+static uint32_t get_be32(const uint8_t *data)
+{
+    return ((uint32_t)data[0] << 24) | ((uint32_t)data[1] << 16) | (data[2] << 8) | data[3];
+}
+
+static void mock_ack(struct mock_mcu *mock, uint8_t status)
+{
+    uint8_t cmd = mock->file ? FILE_DOWNLOAD_TRANS_CMD : UPDATE_TRANS_CMD;
+
+    if (!mock->ack_delay) {
+        host_frame_send(mock->uart, cmd, &status, mock->file ? 1 : 0);
+    } else if (mock->ack_count < ACK_QUEUE) {
+        unsigned i = (mock->ack_head + mock->ack_count++) % ACK_QUEUE;
+        mock->ack_due[i] = tuya_mcu_get_tick() + mock->ack_delay;
+        mock->ack_status[i] = status;
+    }
+}
+
+static void mock_start(struct mock_mcu *mock, const uint8_t *data, size_t len)
+{
+    uint8_t code = mock->start_reply;
+
+    if (mock->file) {
+        char        json[128] = { 0 };
+        const char *size;
+        memcpy(json, data, len < sizeof(json) - 1 ? len : sizeof(json) - 1);
+        size = strstr(json, "\"len\":");
+        mock->size = size ? strtoul(size + 6, NULL, 10) : 0;
+    } else {
+        mock->size = get_be32(data);
+    }
+    mock->starts++;
+    host_frame_send(mock->uart, mock->file ? FILE_DOWNLOAD_START_CMD : UPDATE_START_CMD, &code,
+                    mock->start_reply < 0 ? 0 : 1);
+}
+
+static void mock_packet(struct mock_mcu *mock, const uint8_t *data, size_t len)
+{
+    size_t   hdr_len = mock->file ? 6 : 4;
+    uint32_t offset = get_be32(data + hdr_len - 4);
+
+    if (len > hdr_len) {
+        mock->packets++;
+        if (mock->drop_every && mock->packets % mock->drop_every == 0)
+            return; // Lost on the way, no ack
+        if (mock->nack_every && mock->packets % mock->nack_every == 0) {
+            mock_ack(mock, 1);
+            return;
+        }
+    }
+    if (len == hdr_len && offset == mock->size) {
+        mock->end = true;
+        mock->complete = !memcmp(mock->image, image, IMAGE_SIZE);
+    } else if (offset + len - hdr_len <= sizeof(mock->image)) {
+        memcpy(mock->image + offset, data + hdr_len, len - hdr_len);
+        if (offset < mock->first)
+            mock->first = offset;
+    }
+    mock_ack(mock, 0);
+}
+
+static void mock_handle(struct mock_mcu *mock, uint8_t cmd, const uint8_t *data, size_t len)
+{
+    if (mock->outage_at && mock->packets >= mock->outage_at && mock->outage_len) {
+        mock->outage_len--;
+        return; // Link is down
+    }
+    if (cmd == UPDATE_START_CMD || cmd == FILE_DOWNLOAD_START_CMD)
+        mock_start(mock, data, len);
+    else if (cmd == UPDATE_TRANS_CMD || cmd == FILE_DOWNLOAD_TRANS_CMD)
+        mock_packet(mock, data, len);
+}
+
+static void mock_step(struct mock_mcu *mock)
+{
+    uint8_t        cmd = mock->file ? FILE_DOWNLOAD_TRANS_CMD : UPDATE_TRANS_CMD;
+    const uint8_t *data;
+    size_t         len;
+
+    while (mock->ack_count && (int32_t)(tuya_mcu_get_tick() - mock->ack_due[mock->ack_head]) >= 0) {
+        host_frame_send(mock->uart, cmd, &mock->ack_status[mock->ack_head], mock->file ? 1 : 0);
+        mock->ack_head = (mock->ack_head + 1) % ACK_QUEUE;
+        mock->ack_count--;
+    }
+    while (host_frame_next(mock->uart, &mock->rx, &cmd, &data, &len))
+        mock_handle(mock, cmd, data, len);
+}
+
+static int read_image(void *arg, uint32_t offset, uint8_t *buf, size_t len)
+{
+    memcpy(buf, image + offset, len);
+    return len;
+}
+
+static int run(const struct run_params *p)
+{
+    static struct mock_mcu mock;
+    host_uart_t           *uart;
+    tuya_mcu_t             mcu;
+    tuya_xfer_t            xfer;
+    tuya_xfer_status_t     status;
+    int                    ret = -1;
+
+    memset(&mock, 0, sizeof(mock));
+    mock.file = p->file;
+    mock.start_reply = p->start_reply;
+    mock.drop_every = p->drop_every;
+    mock.nack_every = p->nack_every;
+    mock.outage_at = p->outage_at;
+    mock.outage_len = p->outage_len;
+    mock.ack_delay = p->ack_delay;
+    mock.first = IMAGE_SIZE;
+    // An earlier attempt got this far
+    memcpy(mock.image, image, p->offset);
+    if (host_uart_pair_create(&uart, &mock.uart, FIFO_SIZE) != 0 || tuya_mcu_init(&mcu, uart) != 0)
+        return -1;
+
+    tuya_xfer_config_t config = { .size = IMAGE_SIZE,
+                                  .read = read_image,
+                                  .window = p->window,
+                                  .timeout_ms = 20,
+                                  .retries = 3,
+                                  .resumes = p->resumes,
+                                  .offset = p->offset };
+    tuya_xfer_file_t   file = { .name = "clip.mp3", .id = 7, .type = 1 };
+    xfer = p->file ? tuya_xfer_start_file(mcu, &config, &file) : tuya_xfer_start_ota(mcu, &config);
+    if (!xfer)
+        goto out;
+
+    uint32_t start = tuya_mcu_get_tick();
+    while (!tuya_xfer_finished(xfer) && tuya_mcu_get_tick() - start < RUN_TIMEOUT_MS) {
+        mock_step(&mock);
+        tuya_mcu_tick(mcu);
+        tuya_xfer_tick(xfer);
+    }
+    tuya_xfer_get_status(xfer, &status);
+    printf("%-12s window %u packet %4u: %s, %" PRIu32 " bytes, %u retries, %u resumes, %" PRIu32 " bytes/s\n",
+           p->name, p->window, status.packet_size, status.state == TUYA_XFER_DONE ? "done" : "FAILED", status.acked,
+           status.retries, status.resumes, status.bytes_per_sec);
+
+    if (status.state == TUYA_XFER_DONE && mock.end && mock.complete && mock.size == IMAGE_SIZE && status.acked == IMAGE_SIZE &&
+        mock.starts == p->starts && mock.first == p->offset && !memcmp(mock.image, image, IMAGE_SIZE))
+        ret = 0;
+    tuya_xfer_destroy(xfer);
+out:
+    tuya_mcu_deinit(mcu);
+    host_uart_pair_destroy(uart, mock.uart);
+    return ret;
+}
+
+static int app_update_start(tuya_mcu_t mcu, uint8_t ver, uint8_t cmd, const uint8_t *data, size_t len, void *arg)
+{
+    return 0;
+}
+
+static int run_silent_mcu(void)
+{
+    host_uart_t           *uart, *peer;
+    tuya_mcu_t             mcu;
+    tuya_xfer_t            xfer;
+    tuya_xfer_status_t     status;
+    tuya_mcu_cmd_handler_t handler;
+    void                  *arg;
+    int                    app_arg;
+
+    if (host_uart_pair_create(&uart, &peer, FIFO_SIZE) != 0 || tuya_mcu_init(&mcu, uart) != 0)
+        return -1;
+    // Application handler of the start command, the transfer must give it back
+    tuya_mcu_register_cmd_handler(mcu, UPDATE_START_CMD, app_update_start, &app_arg);
+
+    tuya_xfer_config_t config = { .size = IMAGE_SIZE, .read = read_image, .window = 1, .timeout_ms = 5, .retries = 2 };
+    xfer = tuya_xfer_start_ota(mcu, &config);
+    if (!xfer)
+        return -1;
+    while (!tuya_xfer_finished(xfer))
+        tuya_xfer_tick(xfer);
+    tuya_xfer_get_status(xfer, &status);
+    printf("%-12s %s after %u retries\n", "silent-mcu", status.state == TUYA_XFER_FAILED ? "failed" : "NOT FAILED",
+           status.retries);
+
+    tuya_xfer_destroy(xfer);
+    tuya_mcu_get_cmd_handler(mcu, UPDATE_START_CMD, &handler, &arg);
+    printf("%-12s start handler %s\n", "silent-mcu",
+           handler == app_update_start && arg == &app_arg ? "restored" : "NOT RESTORED");
+    tuya_mcu_deinit(mcu);
+    host_uart_pair_destroy(uart, peer);
+    return status.state == TUYA_XFER_FAILED && status.retries == 2 && handler == app_update_start && arg == &app_arg
+               ? 0
+               : -1;
+}
+
+int main(void)
+{
+    static const struct run_params runs[] = {
+        { .name = "legacy", .window = 1, .start_reply = -1, .starts = 1 },
+        { .name = "256", .window = 1, .start_reply = 0, .starts = 1 },
+        { .name = "1024", .window = 1, .start_reply = 2, .starts = 1 },
+        { .name = "windowed", .window = 4, .start_reply = 2, .starts = 1 },
+        { .name = "lossy", .window = 1, .start_reply = 1, .drop_every = 7, .starts = 1 },
+        // Acks later than timeout_ms, every packet is sent twice and acked twice
+        { .name = "late-ack", .window = 1, .start_reply = 2, .ack_delay = 30, .starts = 1 },
+        { .name = "late-lossy", .window = 2, .start_reply = 2, .drop_every = 7, .ack_delay = 30, .starts = 1 },
+        { .name = "file", .file = true, .window = 1, .start_reply = 2, .starts = 1 },
+        { .name = "file-nack", .file = true, .window = 1, .start_reply = 1, .nack_every = 5, .starts = 1 },
+        { .name = "file-resume",
+          .file = true,
+          .window = 2,
+          .start_reply = 0,
+          .outage_at = 100,
+          .outage_len = 8,
+          .resumes = 1,
+          .starts = 2 },
+        { .name = "file-offset", .file = true, .window = 1, .start_reply = 2, .offset = 40000, .starts = 1 },
+    };
+    int failed = 0;
+
+    for (size_t i = 0; i < sizeof(image); i++)
+        image[i] = (uint8_t)(i * 31 + (i >> 8));
+
+    for (size_t i = 0; i < sizeof(runs) / sizeof(runs[0]); i++)
+        failed |= run(&runs[i]);
+    failed |= run_silent_mcu();
+    return failed ? 1 : 0;
+}
@@ -0,0 +1,236 @@
+/*
+ * Copyright (c) 2025 <qb4.dev@gmail.com>
+ *
+ * SPDX-License-Identifier: LGPL-2.1-or-later
+ */
+
+/*
+ * Protocol engine throughput benchmark
+ *
+ * Runs tuya_frame_receive (through tuya_mcu_tick) and tuya_frame_send
+ * (through tuya_mcu_send_dp) over an in-memory UART link and reports
+ * frames/s, DPs/s and ns per byte. rx-stream passes STREAM_TRANS_CMD
+ * frames larger than the rx buffer through to a sink.
+ */
+
+#include "host-platform.h"
+#include "tuya-mcu.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#define FIFO_SIZE (1024 * 1024)
+#define FRAMES_PER_TICK 1024
+#define NOISE_LEN 32
+#define STREAM_DATA_LEN 4096
+
+struct bench_result {
+    const char *name;
+    uint64_t    frames;
+    uint64_t    dps;
+    uint64_t    bytes;
+    uint64_t    elapsed_ns;
+};
+
+static uint64_t dp_count;
+
+static int on_dps(tuya_mcu_t mcu, const uint8_t *dps, size_t len, void *arg)
+{
+    tuya_dp_iter_t it;
+    tuya_dp_view_t view;
+
+    tuya_dp_iter_init(&it, dps, len);
+    while (tuya_dp_iter_next(&it, &view) > 0)
+        dp_count++;
+    return 0;
+}
+
+static uint64_t stream_bytes;
+static uint64_t stream_frames_ok;
+
+static int on_stream(tuya_mcu_t mcu, const tuya_mcu_stream_hdr_t *hdr, uint32_t offset, const uint8_t *data,
+                     size_t len, void *arg)
+{
+    stream_bytes += len;
+    return 0;
+}
+
+static void on_stream_done(tuya_mcu_t mcu, const tuya_mcu_stream_hdr_t *hdr, bool ok, void *arg)
+{
+    if (ok)
+        stream_frames_ok++;
+}
+
+/* STATE_UPLOAD frame carrying a bool, a value and an enum DP */
+static size_t build_state_upload(uint8_t *out)
+{
+    uint8_t   payload[64];
+    size_t    len = 0;
+    tuya_dp_t dp;
+
+    tuya_dp_set_bool(&dp, 1, true);
+    len += tuya_dp_serialize(&dp, payload + len, sizeof(payload) - len);
+    tuya_dp_set_value(&dp, 2, 1234);
+    len += tuya_dp_serialize(&dp, payload + len, sizeof(payload) - len);
+    tuya_dp_set_enum(&dp, 3, 2);
+    len += tuya_dp_serialize(&dp, payload + len, sizeof(payload) - len);
+    return host_frame_build(out, STATE_UPLOAD_CMD, payload, len);
+}
+
+static int bench_rx(tuya_mcu_t mcu, host_uart_t *peer, uint64_t frames, size_t noise,
+                    struct bench_result *res)
+{
+    uint8_t  frame[128];
+    uint8_t  junk[NOISE_LEN];
+    size_t   frame_len = build_state_upload(frame);
+    uint64_t sent = 0;
+
+    for (size_t i = 0; i < sizeof(junk); i++)
+        junk[i] = (uint8_t)(i * 7 + 1) == FRAME_FIRST ? 0 : (uint8_t)(i * 7 + 1);
+
+    dp_count = 0;
+    res->bytes = 0;
+    uint64_t start = host_time_ns();
+    while (sent < frames) {
+        for (int i = 0; i < FRAMES_PER_TICK && sent < frames; i++, sent++) {
+            if (host_uart_write(peer, junk, noise) != noise ||
+                host_uart_write(peer, frame, frame_len) != frame_len)
+                return -1;
+            res->bytes += noise + frame_len;
+        }
+        tuya_mcu_tick(mcu);
+        host_uart_flush(peer);
+    }
+    res->elapsed_ns = host_time_ns() - start;
+    res->frames = frames;
+    res->dps = dp_count;
+    return 0;
+}
+
+static int bench_rx_stream(tuya_mcu_t mcu, host_uart_t *peer, uint64_t frames, struct bench_result *res)
+{
+    static uint8_t        frame[PROTOCOL_HEAD + 6 + STREAM_DATA_LEN];
+    static uint8_t        payload[6 + STREAM_DATA_LEN];
+    tuya_mcu_stream_hdr_t hdr = { .cmd = STREAM_TRANS_CMD, .id = 1 };
+
+    stream_bytes = 0;
+    stream_frames_ok = 0;
+    res->bytes = 0;
+    uint64_t start = host_time_ns();
+    for (uint64_t i = 0; i < frames; i++) {
+        // Same layout tuya_mcu_send_stream puts on the wire
+        hdr.offset = i * STREAM_DATA_LEN;
+        payload[0] = hdr.id >> 8;
+        payload[1] = hdr.id & 0xFF;
+        payload[2] = hdr.offset >> 24;
+        payload[3] = (hdr.offset >> 16) & 0xFF;
+        payload[4] = (hdr.offset >> 8) & 0xFF;
+        payload[5] = hdr.offset & 0xFF;
+        memset(payload + 6, (int)i, STREAM_DATA_LEN);
+        size_t frame_len = host_frame_build(frame, STREAM_TRANS_CMD, payload, sizeof(payload));
+        if (host_uart_write(peer, frame, frame_len) != frame_len)
+            return -1;
+        res->bytes += frame_len;
+        tuya_mcu_tick(mcu);
+        host_uart_flush(peer);
+    }
+    res->elapsed_ns = host_time_ns() - start;
+    res->frames = frames;
+    res->dps = 0;
+    return stream_frames_ok == frames && stream_bytes == frames * STREAM_DATA_LEN ? 0 : -1;
+}
+
+static int bench_tx(tuya_mcu_t mcu, host_uart_t *peer, uint64_t frames, struct bench_result *res)
+{
+    tuya_dp_t dp;
+
+    res->bytes = 0;
+    uint64_t start = host_time_ns();
+    for (uint64_t i = 0; i < frames; i++) {
+        tuya_dp_set_value(&dp, 2, (int32_t)i);
+        if (tuya_mcu_send_dp(mcu, &dp) < 0)
+            return -1;
+        res->bytes += host_uart_pending(peer);
+        host_uart_flush(peer);
+    }
+    res->elapsed_ns = host_time_ns() - start;
+    res->frames = frames;
+    res->dps = frames;
+    return 0;
+}
+
+static int bench_tx_batch(tuya_mcu_t mcu, host_uart_t *peer, uint64_t dps, size_t batch,
+                          struct bench_result *res)
+{
+    tuya_dp_t dp[16];
+    uint64_t  sent = 0;
+
+    if (batch > sizeof(dp) / sizeof(dp[0]))
+        return -1;
+
+    res->bytes = 0;
+    res->frames = 0;
+    uint64_t start = host_time_ns();
+    while (sent < dps) {
+        size_t n = 0;
+        for (; n < batch && sent < dps; n++, sent++)
+            tuya_dp_set_value(&dp[n], 2 + n, (int32_t)sent);
+
+        int frames = tuya_mcu_send_dps(mcu, dp, n);
+        if (frames < 0)
+            return -1;
+        res->frames += frames;
+        res->bytes += host_uart_pending(peer);
+        host_uart_flush(peer);
+    }
+    res->elapsed_ns = host_time_ns() - start;
+    res->dps = dps;
+    return 0;
+}
+
+static void print_result(const struct bench_result *res)
+{
+    double sec = res->elapsed_ns / 1e9;
+
+    printf("%-10s %10" PRIu64 " frames %10" PRIu64 " DPs %11" PRIu64 " bytes %8.3f s"
+           " %12.0f frames/s %12.0f DPs/s %8.2f ns/byte\n",
+           res->name, res->frames, res->dps, res->bytes, sec, res->frames / sec, res->dps / sec,
+           (double)res->elapsed_ns / res->bytes);
+}
+
+int main(int argc, char *argv[])
+{
+    uint64_t            frames = argc > 1 ? strtoull(argv[1], NULL, 0) : 200000;
+    host_uart_t        *uart, *peer;
+    tuya_mcu_t          mcu;
+    struct bench_result res[5] = { { .name = "rx" },       { .name = "rx-noise" },  { .name = "tx" },
+                                   { .name = "tx-batch" }, { .name = "rx-stream" } };
+
+    if (host_uart_pair_create(&uart, &peer, FIFO_SIZE) != 0 || tuya_mcu_init(&mcu, uart) != 0) {
+        fprintf(stderr, "init failed\n");
+        return 1;
+    }
+    tuya_mcu_set_dp_batch_handler(mcu, on_dps, NULL);
+    tuya_mcu_set_stream_sink(mcu, on_stream, on_stream_done, NULL);
+    tuya_mcu_set_stream_max_len(mcu, 6 + STREAM_DATA_LEN);
+
+    if (bench_rx(mcu, peer, frames, 0, &res[0]) != 0 || bench_rx(mcu, peer, frames, NOISE_LEN, &res[1]) != 0 ||
+        bench_tx(mcu, peer, frames, &res[2]) != 0 || bench_tx_batch(mcu, peer, frames, 8, &res[3]) != 0 ||
+        bench_rx_stream(mcu, peer, frames / 16, &res[4]) != 0) {
+        fprintf(stderr, "benchmark failed\n");
+        return 1;
+    }
+    for (size_t i = 0; i < sizeof(res) / sizeof(res[0]); i++)
+        print_result(&res[i]);
+    const tuya_mcu_stats_t *stats = tuya_mcu_get_stats(mcu);
+    printf("rx discarded %" PRIu32 " bytes, %" PRIu32 " checksum errors\n", stats->rx_discarded,
+           stats->rx_checksum_errors);
+    printf("handler us:");
+    for (int i = 0; i < TUYA_MCU_HIST_BUCKETS; i++)
+        printf(" %" PRIu32, stats->handler_us[i]);
+    printf("\n");
+
+    tuya_mcu_deinit(mcu);
+    host_uart_pair_destroy(uart, peer);
+    return 0;
+}
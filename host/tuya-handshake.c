@@ -0,0 +1,149 @@
+/*
+ * Copyright (c) 2025 <qb4.dev@gmail.com>
+ *
+ * SPDX-License-Identifier: LGPL-2.1-or-later
+ */
+
+/*
+ * Handshake time-to-ready benchmark
+ *
+ * Drives the heartbeat / product information state machine against a
+ * scripted MCU on a simulated clock, one millisecond per step, so results do
+ * not depend on the host. Each scenario delays or drops the MCU answers
+ * differently and runs with the default handshake and with fast start; the
+ * time until TUYA_MCU_INITIALIZED, until the first DP and the frames exchanged
+ * are reported. Fails if a scenario never gets there.
+ */
+
+#include "host-platform.h"
+#include "tuya-mcu.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#define FIFO_SIZE 4096
+#define SIM_LIMIT 60000 // Simulated ms before a scenario is given up
+
+struct scenario {
+    const char *name;
+    uint32_t    delay_ms;   // MCU answer latency
+    uint32_t    boot_ms;    // MCU ignores everything before this
+    unsigned    drop_info;  // Product information queries left unanswered
+    unsigned    drop_beats; // Heartbeats left unanswered
+};
+
+static const struct scenario scenarios[] = {
+    { "instant", 0, 0, 0, 0 },
+    { "slow 50 ms", 50, 0, 0, 0 },
+    { "slow 300 ms", 300, 0, 0, 0 },
+    { "late boot 3 s", 5, 3000, 0, 0 },
+    { "info lost once", 5, 0, 1, 0 },
+    { "beats lost twice", 5, 0, 0, 2 },
+};
+
+struct script {
+    const struct scenario *sc;
+    unsigned               beats;   // Heartbeats seen since boot
+    unsigned               queries; // Product information queries seen
+};
+
+/* Deaf until boot_ms, then drops the first drop_beats heartbeats and drop_info queries */
+static bool script_handle(host_mock_t *mock, uint8_t cmd, const uint8_t *data, size_t len)
+{
+    struct script *script = mock->arg;
+
+    if (mock->now < script->sc->boot_ms)
+        return true;
+    if (cmd == HEARTBEAT_CMD)
+        return script->beats++ < script->sc->drop_beats;
+    if (cmd == PRODUCT_INFO_CMD)
+        return script->queries++ < script->sc->drop_info;
+    return false;
+}
+
+struct handshake_result {
+    uint32_t ready;    // TUYA_MCU_INITIALIZED timestamp, 0 if not reached
+    uint32_t first_dp; // First DP timestamp, 0 if none
+};
+
+static int on_state(tuya_mcu_t mcu, enum tuya_mcu_state st, void *arg)
+{
+    struct handshake_result *res = arg;
+
+    if (st == TUYA_MCU_INITIALIZED)
+        res->ready = tuya_mcu_now(mcu);
+    return 0;
+}
+
+static int on_dps(tuya_mcu_t mcu, const uint8_t *dps, size_t len, void *arg)
+{
+    struct handshake_result *res = arg;
+
+    if (!res->first_dp)
+        res->first_dp = tuya_mcu_now(mcu);
+    return 0;
+}
+
+static uint32_t count_frames(const tuya_mcu_cmd_stats_t *table, uint8_t cmd)
+{
+    uint32_t frames = 0;
+
+    for (int i = 0; i <= TUYA_MCU_STATS_CMDS; i++) {
+        if (cmd == 0xFF || i == cmd)
+            frames += table[i].frames;
+    }
+    return frames;
+}
+
+static bool dp_seen(void *arg)
+{
+    return ((struct handshake_result *)arg)->first_dp != 0;
+}
+
+static int run(const struct scenario *sc, bool fast_start)
+{
+    static host_mock_t      mock;
+    struct script           script = { .sc = sc };
+    struct handshake_result res = { 0 };
+    host_uart_t            *uart;
+    tuya_mcu_t              mcu;
+
+    if (host_mock_init(&mock, &uart, FIFO_SIZE) != 0 || tuya_mcu_init(&mcu, uart) != 0)
+        return -1;
+    mock.delay_ms = sc->delay_ms;
+    mock.handler = script_handle;
+    mock.arg = &script;
+    tuya_mcu_set_clock(mcu, host_mock_clock, &mock);
+    tuya_mcu_set_state_handler(mcu, on_state, &res);
+    tuya_mcu_set_dp_batch_handler(mcu, on_dps, &res);
+    if (fast_start)
+        tuya_mcu_set_fast_start(mcu, TUYA_MCU_FAST_START_INITIAL, TUYA_MCU_FAST_START_MAX);
+
+    // Engine and MCU are powered up together at 0
+    host_mock_run(mcu, &mock, SIM_LIMIT, dp_seen, &res);
+
+    const tuya_mcu_stats_t *stats = tuya_mcu_get_stats(mcu);
+    if (res.first_dp)
+        printf("%-18s %-4s %8" PRIu32 " %8" PRIu32 " %6" PRIu32 " %6" PRIu32 " %6" PRIu32 " %6" PRIu32 "\n", sc->name,
+               fast_start ? "fast" : "", res.ready, res.first_dp, count_frames(stats->tx, HEARTBEAT_CMD),
+               count_frames(stats->tx, PRODUCT_INFO_CMD), count_frames(stats->tx, 0xFF),
+               count_frames(stats->rx, 0xFF));
+    else
+        printf("%-18s %-4s not ready after %u ms\n", sc->name, fast_start ? "fast" : "", SIM_LIMIT);
+
+    tuya_mcu_deinit(mcu);
+    host_mock_destroy(&mock, uart);
+    return res.first_dp ? 0 : -1;
+}
+
+int main(void)
+{
+    int failed = 0;
+
+    printf("scenario                ready ms first dp  beats  infos tx frm rx frm\n");
+    for (size_t i = 0; i < sizeof(scenarios) / sizeof(scenarios[0]); i++) {
+        failed |= run(&scenarios[i], false);
+        failed |= run(&scenarios[i], true);
+    }
+    return failed ? 1 : 0;
+}
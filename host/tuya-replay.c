@@ -0,0 +1,161 @@
+/*
+ * Copyright (c) 2025 <qb4.dev@gmail.com>
+ *
+ * SPDX-License-Identifier: LGPL-2.1-or-later
+ */
+
+/*
+ * Capture replay
+ *
+ * Feeds the rx records of a capture dumped with tuya_mcu_dump_capture back
+ * through the protocol engine over an in-memory UART link, with
+ * tuya_mcu_get_tick following the capture timestamps. Prints what the engine
+ * made of the traffic and how long parsing took, optionally repeated to
+ * benchmark a customer's traffic mix.
+ *
+ *   tuya-replay capture.bin [repeat]
+ */
+
+#include "host-platform.h"
+#include "tuya-mcu.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define FIFO_SIZE (64 * 1024)
+
+struct replay_result {
+    uint64_t rx_bytes;   // Captured rx bytes fed to the engine
+    uint64_t tx_frames;  // Captured tx frames
+    uint64_t tx_bytes;   // Captured tx bytes
+    uint64_t replay_tx;  // Bytes the engine sent during the replay
+    uint64_t dps;        // DPs delivered
+    uint64_t elapsed_ns; // Time spent in the engine
+};
+
+static int on_dps(tuya_mcu_t mcu, const uint8_t *dps, size_t len, void *arg)
+{
+    struct replay_result *res = arg;
+    tuya_dp_iter_t        it;
+    tuya_dp_view_t        view;
+
+    tuya_dp_iter_init(&it, dps, len);
+    while (tuya_dp_iter_next(&it, &view) > 0)
+        res->dps++;
+    return 0;
+}
+
+static int on_stream(tuya_mcu_t mcu, const tuya_mcu_stream_hdr_t *hdr, uint32_t offset, const uint8_t *data,
+                     size_t len, void *arg)
+{
+    return 0;
+}
+
+static uint8_t *read_file(const char *path, size_t *len)
+{
+    FILE    *f = fopen(path, "rb");
+    uint8_t *buf = NULL;
+    long     size;
+
+    if (!f)
+        return NULL;
+    if (fseek(f, 0, SEEK_END) == 0 && (size = ftell(f)) >= 0 && fseek(f, 0, SEEK_SET) == 0) {
+        buf = malloc(size ? size : 1);
+        if (buf && fread(buf, 1, size, f) != (size_t)size) {
+            free(buf);
+            buf = NULL;
+        }
+        *len = size;
+    }
+    fclose(f);
+    return buf;
+}
+
+static int replay(tuya_mcu_t mcu, host_uart_t *peer, const uint8_t *dump, size_t len, struct replay_result *res)
+{
+    static uint8_t     drain[FIFO_SIZE];
+    tuya_capture_rec_t rec;
+    size_t             pos;
+    int                ret;
+
+    if (tuya_capture_open(dump, len, &pos) != 0)
+        return -1;
+
+    while ((ret = tuya_capture_next(dump, len, &pos, &rec)) > 0) {
+        host_tick_set(rec.tick);
+        if (rec.flags & TUYA_CAPTURE_TX) {
+            // Engine makes its own, only give its timers a chance to fire
+            res->tx_frames++;
+            res->tx_bytes += rec.len;
+        } else {
+            if (host_uart_write(peer, rec.data, rec.len) != rec.len)
+                return -1;
+            res->rx_bytes += rec.len;
+        }
+        uint64_t start = host_time_ns();
+        tuya_mcu_tick(mcu);
+        res->elapsed_ns += host_time_ns() - start;
+        res->replay_tx += host_uart_read(peer, drain, sizeof(drain));
+    }
+    return ret;
+}
+
+static void print_stats(const tuya_mcu_stats_t *stats)
+{
+    printf("cmd    rx frames   rx bytes  tx frames   tx bytes\n");
+    for (int i = 0; i <= TUYA_MCU_STATS_CMDS; i++) {
+        const tuya_mcu_cmd_stats_t *rx = &stats->rx[i], *tx = &stats->tx[i];
+        if (!rx->frames && !tx->frames)
+            continue;
+        printf("%s0x%02x %10" PRIu32 " %10" PRIu32 " %10" PRIu32 " %10" PRIu32 "\n", i < TUYA_MCU_STATS_CMDS ? " " : ">",
+               i, rx->frames, rx->bytes, tx->frames, tx->bytes);
+    }
+    printf("checksum errors %" PRIu32 ", discarded %" PRIu32 " bytes, oversize %" PRIu32 ", unhandled %" PRIu32
+           "\n",
+           stats->rx_checksum_errors, stats->rx_discarded, stats->rx_oversize, stats->rx_unhandled);
+}
+
+int main(int argc, char *argv[])
+{
+    struct replay_result res = { 0 };
+    host_uart_t         *uart, *peer;
+    tuya_mcu_t           mcu;
+    uint8_t             *dump;
+    size_t               len;
+    unsigned long        repeat = argc > 2 ? strtoul(argv[2], NULL, 0) : 1;
+
+    if (argc < 2) {
+        fprintf(stderr, "usage: %s capture.bin [repeat]\n", argv[0]);
+        return 2;
+    }
+    dump = read_file(argv[1], &len);
+    if (!dump) {
+        fprintf(stderr, "%s: cannot read\n", argv[1]);
+        return 1;
+    }
+    if (host_uart_pair_create(&uart, &peer, FIFO_SIZE) != 0 || tuya_mcu_init(&mcu, uart) != 0) {
+        fprintf(stderr, "init failed\n");
+        return 1;
+    }
+    tuya_mcu_set_dp_batch_handler(mcu, on_dps, &res);
+    tuya_mcu_set_stream_sink(mcu, on_stream, NULL, NULL);
+
+    for (unsigned long i = 0; i < repeat; i++) {
+        if (replay(mcu, peer, dump, len, &res) != 0) {
+            fprintf(stderr, "%s: not a capture or corrupt\n", argv[1]);
+            return 1;
+        }
+    }
+
+    print_stats(tuya_mcu_get_stats(mcu));
+    printf("captured tx %" PRIu64 " frames %" PRIu64 " bytes, replay sent %" PRIu64 " bytes\n", res.tx_frames,
+           res.tx_bytes, res.replay_tx);
+    printf("%" PRIu64 " rx bytes, %" PRIu64 " DPs in %.3f ms, %.2f ns/byte\n", res.rx_bytes, res.dps,
+           res.elapsed_ns / 1e6, res.rx_bytes ? (double)res.elapsed_ns / res.rx_bytes : 0.0);
+
+    tuya_mcu_deinit(mcu);
+    host_uart_pair_destroy(uart, peer);
+    free(dump);
+    return 0;
+}
@@ -12,12 +12,23 @@ extern "C" {
 
 #include "tuya-mcu.h"
 #include "tuya-dp.h"
+#include "tuya-xfer.h"
 
 /**
  * @brief Declare of TUYA MCU Event base
  *
  */
 ESP_EVENT_DECLARE_BASE(TUYA_MCU_EVENT);
+/**
+ * @brief How DP updates are carried through the event loop
+ *
+ * Both flavours carry values up to TUYA_DP_CHUNK_SIZE (64) bytes. Longer DPs are dropped, with
+ * TUYA_MCU_DP_EVENT_REF they are logged and counted in dp_too_large.
+ */
+typedef enum {
+    TUYA_MCU_DP_EVENT_COPY = 0, /*!< TUYA_MCU_EVENT_DP_UPDATE with a copy of tuya_dp_t */
+    TUYA_MCU_DP_EVENT_REF,      /*!< TUYA_MCU_EVENT_DP_REF with a pooled, reference counted tuya_dp_ref_t */
+} tuya_mcu_dp_event_mode_t;
 /**
  * @brief TUYA MCU UART configuration structure
  *
@@ -28,52 +39,227 @@ typedef struct {
         uint32_t           rx_pin;           /*!< UART Rx Pin number */
         uint32_t           tx_pin;           /*!< UART Tx Pin number */
         uint32_t           baud_rate;        /*!< UART baud rate */
+        bool               auto_baud;        /*!< Probe common rates, baud_rate first, until the MCU answers */
         uart_word_length_t data_bits;        /*!< UART data bits length */
         uart_parity_t      parity;           /*!< UART parity */
         uart_stop_bits_t   stop_bits;        /*!< UART stop bits length */
         uint32_t           event_queue_size; /*!< UART event queue size */
     } uart;                                  /*!< UART specific configuration */
+    bool shared_worker;                      /*!< Served by the esp_tuya_mcu_worker_init task, not an own one */
+    bool light_sleep;                        /*!< Allow light sleep between deadlines, see esp_tuya_mcu_init */
+    struct {
+        bool     enable;     /*!< Send heartbeat and product query together, go on as soon as the MCU answers */
+        uint32_t initial_ms; /*!< First retry interval, doubled on every retry */
+        uint32_t max_ms;     /*!< Retry interval limit */
+    } fast_start;            /*!< Start-up handshake */
+    struct {
+        uint32_t interval_ms;     /*!< MCU silence before a heartbeat is sent, 0 keeps all defaults */
+        uint32_t max_interval_ms; /*!< Max time between heartbeats, even while the MCU is talking, 0 is interval_ms */
+        uint8_t  max_missed;      /*!< Unanswered heartbeats before the handshake restarts, 0 never */
+    } heartbeat;                  /*!< Link monitor once initialized */
+    struct {
+        uint8_t  max_count;    /*!< Max DPs packed into one data frame, up to TUYA_MCU_DP_QUEUE_SIZE */
+        uint32_t max_delay_ms; /*!< Max time to wait for more DPs before sending, 0 sends at once */
+    } dp_batch;                /*!< Outbound DP coalescing */
+    struct {
+        bool     enable;          /*!< Keep the last value reported by the MCU for every DP */
+        bool     skip_duplicates; /*!< Drop DP writes equal to the last reported value, unless a write of the id
+                                       is queued or not reported back yet */
+        uint16_t records;         /*!< Shadow records, one per DP id the MCU reports plus one, 0 for the defaults */
+        uint16_t chunks;          /*!< Chunks, one per reported DP id over TUYA_DP_INLINE_SIZE bytes plus one */
+    } dp_shadow;                  /*!< DP shadow state, kept in its own pool apart from dp_pool */
+    struct {
+        uint16_t records; /*!< DP records, each holds a value up to TUYA_DP_INLINE_SIZE bytes, 0 for the defaults */
+        uint16_t chunks;  /*!< Chunks for values up to TUYA_DP_CHUNK_SIZE bytes */
+    } dp_pool;            /*!< Storage of queued and event DPs */
+    tuya_mcu_dp_event_mode_t dp_event_mode; /*!< DP update event flavour */
+    struct {
+        uint32_t timeout_ms; /*!< Time for the MCU to report a DP back after esp_tuya_mcu_write_dp_async, 0 default */
+    } dp_write;              /*!< Acknowledged DP writes */
+    struct {
+        uint8_t  window;     /*!< Reports awaiting esp_tuya_mcu_complete_sync_report, 0 acknowledges on receive */
+        uint32_t timeout_ms; /*!< Time to complete a report before it is failed */
+    } sync_report;           /*!< Synchronous status upload */
+    struct {
+        uint16_t max_len; /*!< Largest stream frame data length, longer ones are taken for noise, 0 default */
+    } stream;             /*!< Stream frames larger than the rx buffer */
 } tuya_mcu_uart_config_t;
 
+#define TUYA_MCU_DP_QUEUE_SIZE   (8)
+#define TUYA_MCU_DP_POOL_RECORDS (32) /*!< Default dp_pool.records */
+#define TUYA_MCU_DP_POOL_CHUNKS  (4)  /*!< Default dp_pool.chunks */
+
+#define TUYA_MCU_STREAM_CHUNK (1024) /*!< Default data bytes per esp_tuya_mcu_send_stream frame, ~1 s at 9600 */
+
+#define TUYA_MCU_DP_SHADOW_RECORDS (32) /*!< Default dp_shadow.records, fits 31 DP ids */
+#define TUYA_MCU_DP_SHADOW_CHUNKS  (4)  /*!< Default dp_shadow.chunks, fits 3 long DP values */
+
 typedef void *esp_tuya_mcu_handle_t;
 
+/**
+ * @brief Shared worker configuration
+ *
+ */
+typedef struct {
+    uint8_t  max_instances;    /*!< TUYA MCUs served by the worker */
+    uint32_t event_queue_size; /*!< Max uart.event_queue_size of a served TUYA MCU */
+} tuya_mcu_worker_config_t;
+
+#define TUYA_MCU_WORKER_CONFIG_DEFAULT() { .max_instances = 4, .event_queue_size = 16 }
+
 #if CONFIG_IDF_TARGET_ESP8266
-#define TUYA_MCU_CONFIG_DEFAULT()              \
-    { .uart = { .uart_port = UART_NUM_0,       \
-                .baud_rate = 9600,             \
-                .data_bits = UART_DATA_8_BITS, \
-                .parity = UART_PARITY_DISABLE, \
-                .stop_bits = UART_STOP_BITS_1, \
-                .event_queue_size = 16 } }
+#define TUYA_MCU_CONFIG_DEFAULT()                                             \
+    { .uart = { .uart_port = UART_NUM_0,                                      \
+                .baud_rate = 9600,                                            \
+                .auto_baud = false,                                           \
+                .data_bits = UART_DATA_8_BITS,                                \
+                .parity = UART_PARITY_DISABLE,                                \
+                .stop_bits = UART_STOP_BITS_1,                                \
+                .event_queue_size = 16 },                                     \
+      .shared_worker = false,                                                 \
+      .light_sleep = false,                                                   \
+      .fast_start = { .enable = false,                                        \
+                      .initial_ms = TUYA_MCU_FAST_START_INITIAL,              \
+                      .max_ms = TUYA_MCU_FAST_START_MAX },                    \
+      .heartbeat = { .interval_ms = TUYA_MCU_HEARTBEAT_INTERVAL,              \
+                     .max_interval_ms = TUYA_MCU_HEARTBEAT_INTERVAL,          \
+                     .max_missed = TUYA_MCU_HEARTBEAT_MAX_MISSED },           \
+      .dp_batch = { .max_count = TUYA_MCU_DP_QUEUE_SIZE, .max_delay_ms = 0 }, \
+      .dp_shadow = { .enable = false,                                         \
+                     .skip_duplicates = false,                                \
+                     .records = TUYA_MCU_DP_SHADOW_RECORDS,                   \
+                     .chunks = TUYA_MCU_DP_SHADOW_CHUNKS },                   \
+      .dp_pool = { .records = TUYA_MCU_DP_POOL_RECORDS,                       \
+                   .chunks = TUYA_MCU_DP_POOL_CHUNKS },                       \
+      .dp_event_mode = TUYA_MCU_DP_EVENT_COPY,                                \
+      .dp_write = { .timeout_ms = 2000 },                                     \
+      .sync_report = { .window = 0, .timeout_ms = 5000 },                     \
+      .stream = { .max_len = TUYA_MCU_STREAM_MAX_LEN } }
 
 #else
-#define TUYA_MCU_CONFIG_DEFAULT()              \
-    { .uart = { .uart_port = UART_NUM_1,       \
-                .rx_pin = GPIO_NUM_23,         \
-                .tx_pin = GPIO_NUM_22,         \
-                .baud_rate = 9600,             \
-                .data_bits = UART_DATA_8_BITS, \
-                .parity = UART_PARITY_DISABLE, \
-                .stop_bits = UART_STOP_BITS_1, \
-                .event_queue_size = 16 } }
+#define TUYA_MCU_CONFIG_DEFAULT()                                             \
+    { .uart = { .uart_port = UART_NUM_1,                                      \
+                .rx_pin = GPIO_NUM_23,                                        \
+                .tx_pin = GPIO_NUM_22,                                        \
+                .baud_rate = 9600,                                            \
+                .auto_baud = false,                                           \
+                .data_bits = UART_DATA_8_BITS,                                \
+                .parity = UART_PARITY_DISABLE,                                \
+                .stop_bits = UART_STOP_BITS_1,                                \
+                .event_queue_size = 16 },                                     \
+      .shared_worker = false,                                                 \
+      .light_sleep = false,                                                   \
+      .fast_start = { .enable = false,                                        \
+                      .initial_ms = TUYA_MCU_FAST_START_INITIAL,              \
+                      .max_ms = TUYA_MCU_FAST_START_MAX },                    \
+      .heartbeat = { .interval_ms = TUYA_MCU_HEARTBEAT_INTERVAL,              \
+                     .max_interval_ms = TUYA_MCU_HEARTBEAT_INTERVAL,          \
+                     .max_missed = TUYA_MCU_HEARTBEAT_MAX_MISSED },           \
+      .dp_batch = { .max_count = TUYA_MCU_DP_QUEUE_SIZE, .max_delay_ms = 0 }, \
+      .dp_shadow = { .enable = false,                                         \
+                     .skip_duplicates = false,                                \
+                     .records = TUYA_MCU_DP_SHADOW_RECORDS,                   \
+                     .chunks = TUYA_MCU_DP_SHADOW_CHUNKS },                   \
+      .dp_pool = { .records = TUYA_MCU_DP_POOL_RECORDS,                       \
+                   .chunks = TUYA_MCU_DP_POOL_CHUNKS },                       \
+      .dp_event_mode = TUYA_MCU_DP_EVENT_COPY,                                \
+      .dp_write = { .timeout_ms = 2000 },                                     \
+      .sync_report = { .window = 0, .timeout_ms = 5000 },                     \
+      .stream = { .max_len = TUYA_MCU_STREAM_MAX_LEN } }
 #endif
 
 typedef enum {
     TUYA_MCU_EVENT_STATE_CHANGED = 0,
     TUYA_MCU_EVENT_CONFIG_REQUEST,
-    TUYA_MCU_EVENT_DP_UPDATE,
+    TUYA_MCU_EVENT_DP_UPDATE,        /*!< Event data is tuya_dp_t */
+    TUYA_MCU_EVENT_DP_REF,           /*!< Event data is tuya_dp_ref_t, valid until handler returns unless retained */
+    TUYA_MCU_EVENT_SYNC_REPORT,      /*!< Event data is tuya_mcu_sync_report_t, follows the report's DP events */
+    TUYA_MCU_EVENT_SYNC_REPORT_DONE, /*!< Event data is tuya_mcu_sync_report_t with result sent to MCU */
+    TUYA_MCU_EVENT_DP_WRITE_DONE,    /*!< Event data is tuya_mcu_dp_write_result_t */
+    TUYA_MCU_EVENT_OTA_PROGRESS,     /*!< Event data is tuya_xfer_status_t, every percent and at the end */
+    TUYA_MCU_EVENT_FILE_PROGRESS,    /*!< Event data is tuya_xfer_status_t, every percent and at the end */
+    TUYA_MCU_EVENT_BAUD_CHANGED,     /*!< Event data is tuya_mcu_baud_t */
 } tuya_mcu_event_id_t;
 
+/**
+ * @brief Synchronous status upload event data
+ *
+ */
+typedef struct {
+    uint16_t id;      /*!< Report id for esp_tuya_mcu_complete_sync_report */
+    bool     success; /*!< Result, TUYA_MCU_EVENT_SYNC_REPORT_DONE only */
+} tuya_mcu_sync_report_t;
+
+/**
+ * @brief Baud rate event data
+ *
+ */
+typedef struct {
+    uint32_t baud; /*!< Rate locked by probing or requested by esp_tuya_mcu_switch_baud */
+    bool     ok;   /*!< false if the MCU did not answer at a requested rate and the old one is back */
+} tuya_mcu_baud_t;
+
+/**
+ * @brief Start the worker task shared by TUYA MCUs initialized with shared_worker set
+ *
+ * One task, queue set and wake semaphore serve all of them instead of one set per TUYA MCU.
+ * Callbacks and event handlers of all of them run in this task, one at a time, so a slow
+ * handler holds up the others. Handlers may init and deinit other TUYA MCUs served by it.
+ *
+ * @param config worker configuration
+ * @return esp_err_t ESP_OK on success, ESP_ERR_INVALID_STATE if already started, ESP_ERR_NO_MEM on error
+ */
+esp_err_t esp_tuya_mcu_worker_init(const tuya_mcu_worker_config_t *config);
+
+/**
+ * @brief Stop the shared worker task
+ *
+ * @return esp_err_t ESP_OK on success, ESP_ERR_INVALID_STATE if not started or still serving a TUYA MCU
+ */
+esp_err_t esp_tuya_mcu_worker_deinit(void);
+
+/**
+ * @brief TUYA MCU statistics
+ *
+ * Counters bumped by API callers (queue full, pool exhausted) are best effort and may miss a count.
+ *
+ */
+typedef struct {
+    tuya_mcu_stats_t proto;                               /*!< Protocol counters: frames and bytes per command, errors */
+    uint32_t         uart_fifo_overflows;                 /*!< UART hardware FIFO overflows */
+    uint32_t         uart_buffer_full;                    /*!< UART driver ring buffer overflows */
+    uint32_t         uart_errors;                         /*!< Parity and framing errors */
+    uint32_t         events_dropped;                      /*!< Events lost to a full event loop queue */
+    uint32_t         dp_queue_full;                       /*!< DP writes refused by a full DP queue */
+    uint32_t         wifi_queue_full;                     /*!< WiFi status updates refused by a full queue */
+    uint32_t         dp_pool_exhausted;                   /*!< DPs dropped for lack of pool records */
+    uint32_t         dp_too_large;                        /*!< DP events dropped, value over TUYA_DP_CHUNK_SIZE */
+    uint8_t          uart_queue_hwm;                      /*!< Most UART events queued at once */
+    uint8_t          dp_queue_hwm;                        /*!< Most DP writes queued at once */
+    uint8_t          events_hwm;                          /*!< Most events awaiting dispatch at once */
+    uint32_t         dp_write_us[TUYA_MCU_HIST_BUCKETS];  /*!< DP write call to frame handed to the UART driver */
+    uint32_t         wakeups;                             /*!< Worker passes serving this MCU */
+    uint32_t         wake_late_us[TUYA_MCU_HIST_BUCKETS]; /*!< Deadline to worker pass: sleep exit and scheduling */
+} esp_tuya_mcu_stats_t;
+
 /**
  * @brief Initialize TUYA MCU
  *
+ * With light_sleep the UART runs from a clock that survives light sleep and Rx activity wakes the chip, while the
+ * link is quiet the worker only runs at the next protocol deadline. Automatic light sleep itself is up to the
+ * application (CONFIG_PM_ENABLE, tickless idle, esp_pm_configure). The bytes that wake the chip are lost, the MCU
+ * resends unanswered frames. Not available on ESP8266, and only UART0/1 can wake an ESP32.
+ *
  * @param config Configuration for TUYA MCU
  * @return esp_tuya_mcu_handle_t Handle of TUYA MCU on success, NULL on error
  */
 esp_tuya_mcu_handle_t esp_tuya_mcu_init(const tuya_mcu_uart_config_t *config);
 
 /**
- * @brief Deinit TUYA MCU 
+ * @brief Deinit TUYA MCU
+ *
+ * Not from an event handler or callback of the same TUYA MCU, the worker task is still serving it there.
+ *
  * @param mcu_hdl handle of TUYA MCU
  * @return esp_err_t ESP_OK on success, ESP_FAIL on error
  */
@@ -111,12 +297,264 @@ esp_err_t esp_tuya_mcu_write_wifi_status(esp_tuya_mcu_handle_t mcu_hdl, uint8_t
 /**
  * @brief Send data point to TUYA MCU
  *
+ * With config dp_shadow.skip_duplicates a value equal to the last one the MCU reported is dropped, as long as
+ * no earlier write of the same DP id is queued or waiting to be reported back.
+ *
  * @param mcu_hdl handle of TUYA MCU
  * @param dp Data point to send
  * @return esp_err_t ESP_OK on success, ESP_FAIL on error
  */
 esp_err_t esp_tuya_mcu_write_dp(esp_tuya_mcu_handle_t mcu_hdl, tuya_dp_t *dp);
 
+/**
+ * @brief Send DP to TUYA MCU and wait for it to be reported back
+ *
+ * Write completes when the MCU reports the written value back or after config dp_write.timeout_ms, a report of
+ * the DP id with another value leaves it waiting. Several writes may be in flight, reports complete the oldest
+ * write of their DP id and value. A DP too large for a data frame fails alone. Duplicate suppression does not apply.
+ *
+ * @param mcu_hdl handle of TUYA MCU
+ * @param dp Data point to send
+ * @param cb Completion callback, runs in TUYA MCU task and must not call back into this API;
+ *           NULL posts TUYA_MCU_EVENT_DP_WRITE_DONE instead
+ * @param arg Argument for callback
+ * @return esp_err_t ESP_OK if queued, ESP_ERR_NO_MEM if DP pool is exhausted, ESP_FAIL on error
+ */
+esp_err_t esp_tuya_mcu_write_dp_async(esp_tuya_mcu_handle_t mcu_hdl, tuya_dp_t *dp, tuya_mcu_dp_write_cb_t cb,
+                                      void *arg);
+
+/**
+ * @brief Keep DP from TUYA_MCU_EVENT_DP_REF event after the handler returns
+ *
+ * @param mcu_hdl handle of TUYA MCU
+ * @param ref DP handle from event data
+ * @return esp_err_t ESP_OK on success, ESP_FAIL if DP has too many references
+ */
+esp_err_t esp_tuya_mcu_dp_retain(esp_tuya_mcu_handle_t mcu_hdl, tuya_dp_ref_t ref);
+
+/**
+ * @brief Release DP retained with esp_tuya_mcu_dp_retain
+ *
+ * @param mcu_hdl handle of TUYA MCU
+ * @param ref DP handle
+ * @return esp_err_t ESP_OK on success, ESP_ERR_INVALID_ARG on error
+ */
+esp_err_t esp_tuya_mcu_dp_release(esp_tuya_mcu_handle_t mcu_hdl, tuya_dp_ref_t ref);
+
+/**
+ * @brief Complete synchronous status upload from TUYA_MCU_EVENT_SYNC_REPORT
+ *
+ * Results are sent to the MCU in report order, a report waits for all older ones.
+ *
+ * @param mcu_hdl handle of TUYA MCU
+ * @param id report id from event data
+ * @param success result for the MCU
+ * @return esp_err_t ESP_OK on success, ESP_ERR_NOT_FOUND if report is unknown or timed out
+ */
+esp_err_t esp_tuya_mcu_complete_sync_report(esp_tuya_mcu_handle_t mcu_hdl, uint16_t id, bool success);
+
+/**
+ * @brief Handle a TUYA MCU command in the worker task
+ *
+ * Handler is called from the receive path with the payload still in the rx buffer and may answer
+ * with tuya_mcu_send_frame() on the tuya_mcu_t it is given. It must not block or call back into this API.
+ *
+ * @param mcu_hdl handle of TUYA MCU
+ * @param cmd command byte
+ * @param handler handler, replaces the built-in one; NULL drops the command
+ * @param arg handler argument
+ * @return esp_err_t ESP_OK on success, ESP_ERR_NO_MEM if handler table is full
+ */
+esp_err_t esp_tuya_mcu_register_cmd_handler(esp_tuya_mcu_handle_t mcu_hdl, uint8_t cmd, tuya_mcu_cmd_handler_t handler,
+                                            void *arg);
+
+/**
+ * @brief Send raw frame to TUYA MCU
+ *
+ * @param mcu_hdl handle of TUYA MCU
+ * @param cmd command byte
+ * @param data payload, may be NULL if len is 0
+ * @param len payload length
+ * @return esp_err_t ESP_OK on success, ESP_FAIL on error
+ */
+esp_err_t esp_tuya_mcu_send_frame(esp_tuya_mcu_handle_t mcu_hdl, uint8_t cmd, const uint8_t *data, size_t len);
+
+/**
+ * @brief Receive stream (STREAM_TRANS_CMD) and map stream (MAPS_STREAM_TRANS_CMD) data
+ *
+ * Sink runs in TUYA MCU task with data straight from the rx buffer, frames larger than the buffer
+ * arrive in several chunks and their checksum is only known when done is called. It must not block
+ * or call back into this API. Such a frame only passes when it is up to config stream.max_len long
+ * and starts a stream or continues the one in progress, any other is taken for noise.
+ *
+ * @param mcu_hdl handle of TUYA MCU
+ * @param sink data sink, NULL stops stream reception
+ * @param done frame end callback, may be NULL
+ * @param arg argument for both
+ * @return esp_err_t ESP_OK on success, ESP_ERR_INVALID_ARG on error
+ */
+esp_err_t esp_tuya_mcu_set_stream_sink(esp_tuya_mcu_handle_t mcu_hdl, tuya_mcu_stream_sink_t sink,
+                                       tuya_mcu_stream_done_t done, void *arg);
+
+/**
+ * @brief Send stream data to TUYA MCU
+ *
+ * Blocks until all frames are written. Each frame holds off the worker for its transmit time, so chunk
+ * bounds the delay seen by rx, heartbeats and timeouts of every MCU the worker serves.
+ *
+ * @param mcu_hdl handle of TUYA MCU
+ * @param hdr stream header, offset is the offset of the first data byte
+ * @param data stream data, sent without copying
+ * @param len data length
+ * @param chunk max data bytes per frame, 0 for TUYA_MCU_STREAM_CHUNK
+ * @return esp_err_t ESP_OK on success, ESP_FAIL on error
+ */
+esp_err_t esp_tuya_mcu_send_stream(esp_tuya_mcu_handle_t mcu_hdl, const tuya_mcu_stream_hdr_t *hdr,
+                                   const uint8_t *data, size_t len, size_t chunk);
+
+/**
+ * @brief Start MCU firmware upgrade
+ *
+ * Image is read with config->read in TUYA MCU task, one packet ahead of the MCU, so the reader
+ * should not block for long. Progress is reported with TUYA_MCU_EVENT_OTA_PROGRESS and, if set,
+ * config->progress in TUYA MCU task.
+ *
+ * @param mcu_hdl handle of TUYA MCU
+ * @param config transfer configuration
+ * @return esp_err_t ESP_OK on success, ESP_ERR_INVALID_STATE if an upgrade is running, ESP_FAIL on error
+ */
+esp_err_t esp_tuya_mcu_start_ota(esp_tuya_mcu_handle_t mcu_hdl, const tuya_xfer_config_t *config);
+
+/**
+ * @brief Abort MCU firmware upgrade in progress
+ *
+ * The transfer is failed by TUYA MCU task, progress callback and event report it from there.
+ *
+ * @param mcu_hdl handle of TUYA MCU
+ * @return esp_err_t ESP_OK on success, ESP_ERR_INVALID_ARG on error
+ */
+esp_err_t esp_tuya_mcu_abort_ota(esp_tuya_mcu_handle_t mcu_hdl);
+
+/**
+ * @brief Start file download to TUYA MCU
+ *
+ * File is read with config->read in TUYA MCU task one packet ahead of the MCU. If the MCU stops
+ * answering the transfer restarts from the last acked offset up to config->resumes times; a failed
+ * download can be started again later with config->offset set to the acked bytes it reported.
+ * Progress is reported with TUYA_MCU_EVENT_FILE_PROGRESS and, if set, config->progress.
+ *
+ * @param mcu_hdl handle of TUYA MCU
+ * @param config transfer configuration
+ * @param file file description
+ * @return esp_err_t ESP_OK on success, ESP_ERR_INVALID_STATE if a download is running, ESP_FAIL on error
+ */
+esp_err_t esp_tuya_mcu_start_file(esp_tuya_mcu_handle_t mcu_hdl, const tuya_xfer_config_t *config,
+                                  const tuya_xfer_file_t *file);
+
+/**
+ * @brief Abort file download in progress
+ *
+ * The transfer is failed by TUYA MCU task, progress callback and event report it from there.
+ *
+ * @param mcu_hdl handle of TUYA MCU
+ * @return esp_err_t ESP_OK on success, ESP_ERR_INVALID_ARG on error
+ */
+esp_err_t esp_tuya_mcu_abort_file(esp_tuya_mcu_handle_t mcu_hdl);
+
+/**
+ * @brief Switch UART to a faster baud rate
+ *
+ * The MCU has to be told first, with whatever product command it uses for that. The new rate is
+ * kept once the MCU answers a heartbeat at it within timeout_ms, otherwise the old rate is restored.
+ * The outcome is reported with TUYA_MCU_EVENT_BAUD_CHANGED.
+ *
+ * @param mcu_hdl handle of TUYA MCU
+ * @param baud new baud rate
+ * @param timeout_ms time for the MCU to answer at the new rate
+ * @return esp_err_t ESP_OK if switching, ESP_ERR_INVALID_STATE while the rate is probed or switched
+ */
+esp_err_t esp_tuya_mcu_switch_baud(esp_tuya_mcu_handle_t mcu_hdl, uint32_t baud, uint32_t timeout_ms);
+
+/**
+ * @brief Get current UART baud rate
+ *
+ * @param mcu_hdl handle of TUYA MCU
+ * @return uint32_t baud rate, 0 while it is probed
+ */
+uint32_t esp_tuya_mcu_get_baud(esp_tuya_mcu_handle_t mcu_hdl);
+
+/**
+ * @brief Read product information reported by TUYA MCU
+ *
+ * @param mcu_hdl handle of TUYA MCU
+ * @param info buffer for product information, only fields flagged in info->present are valid
+ * @return esp_err_t ESP_OK on success, ESP_ERR_INVALID_STATE if MCU is not initialized yet
+ */
+esp_err_t esp_tuya_mcu_get_product_info(esp_tuya_mcu_handle_t mcu_hdl, tuya_mcu_product_info_t *info);
+
+/**
+ * @brief Get statistics of TUYA MCU
+ *
+ * @param mcu_hdl handle of TUYA MCU
+ * @param stats buffer for statistics
+ * @return esp_err_t ESP_OK on success, ESP_ERR_INVALID_ARG on error
+ */
+esp_err_t esp_tuya_mcu_get_stats(esp_tuya_mcu_handle_t mcu_hdl, esp_tuya_mcu_stats_t *stats);
+
+/**
+ * @brief Reset statistics of TUYA MCU
+ *
+ * @param mcu_hdl handle of TUYA MCU
+ * @return esp_err_t ESP_OK on success, ESP_ERR_INVALID_ARG on error
+ */
+esp_err_t esp_tuya_mcu_reset_stats(esp_tuya_mcu_handle_t mcu_hdl);
+
+/**
+ * @brief Start recording raw UART traffic of TUYA MCU
+ *
+ * Received bytes and sent frames are kept with their tick in a ring of size bytes,
+ * the oldest records are dropped first. Dump it with esp_tuya_mcu_dump_capture and
+ * replay it on a host with tuya-replay.
+ *
+ * @param mcu_hdl handle of TUYA MCU
+ * @param size ring size in bytes
+ * @return esp_err_t ESP_OK on success, ESP_FAIL if already recording or out of memory
+ */
+esp_err_t esp_tuya_mcu_enable_capture(esp_tuya_mcu_handle_t mcu_hdl, size_t size);
+
+/**
+ * @brief Stop recording and free the capture ring
+ *
+ * @param mcu_hdl handle of TUYA MCU
+ * @return esp_err_t ESP_OK on success, ESP_ERR_INVALID_ARG on error
+ */
+esp_err_t esp_tuya_mcu_disable_capture(esp_tuya_mcu_handle_t mcu_hdl);
+
+/**
+ * @brief Write the recorded traffic, oldest first
+ *
+ * Runs with the instance locked, write should only copy the data out.
+ *
+ * @param mcu_hdl handle of TUYA MCU
+ * @param write called with consecutive parts of the dump
+ * @param arg argument passed to write
+ * @return esp_err_t ESP_OK on success, ESP_FAIL if not recording or write failed
+ */
+esp_err_t esp_tuya_mcu_dump_capture(esp_tuya_mcu_handle_t mcu_hdl, tuya_capture_write_t write, void *arg);
+
+/**
+ * @brief Read last value of data point reported by TUYA MCU
+ *
+ * Requires dp_shadow.enable in configuration.
+ *
+ * @param mcu_hdl handle of TUYA MCU
+ * @param id Data point ID
+ * @param dp Data point to fill
+ * @return esp_err_t ESP_OK on success, ESP_ERR_NOT_FOUND if DP was not reported yet,
+ *         ESP_ERR_INVALID_STATE if DP shadow is disabled
+ */
+esp_err_t esp_tuya_mcu_get_dp(esp_tuya_mcu_handle_t mcu_hdl, uint8_t id, tuya_dp_t *dp);
+
 #ifdef __cplusplus
 }
 #endif
@@ -6,3 +6,37 @@
 int tuya_mcu_uart_rx(void *, uint8_t *c);
 int tuya_mcu_uart_tx(void *, uint8_t c);
 uint32_t tuya_mcu_get_tick(void);
+
+/*
+ * Microsecond timestamp for handler timing statistics.
+ * Optional: the default implementation scales tuya_mcu_get_tick.
+ */
+uint32_t tuya_mcu_get_time_us(void);
+
+/*
+ * Read up to len bytes, waiting at most timeout_ms for the first one.
+ * Returns number of bytes read, 0 if none arrived, negative on error.
+ * Optional: the default implementation falls back to tuya_mcu_uart_rx.
+ */
+int tuya_mcu_uart_read(void *, uint8_t *buf, size_t len, uint32_t timeout_ms);
+
+/*
+ * Write a whole buffer (usually one complete frame) in a single driver call.
+ * Returns number of bytes written, negative on error.
+ * Optional: the default implementation falls back to tuya_mcu_uart_tx.
+ */
+int tuya_mcu_uart_write(void *, const uint8_t *buf, size_t len);
+
+/*
+ * Change the UART baud rate; bytes still in flight may be lost.
+ * Returns 0 on success, negative on error.
+ * Optional: unsupported by default, which disables baud probing and switching.
+ */
+int tuya_mcu_uart_set_baud(void *, uint32_t baud);
+
+/*
+ * Short critical section around DP pool free lists, which are shared by the
+ * worker and API callers. Optional: no-op by default.
+ */
+void tuya_mcu_enter_critical(void);
+void tuya_mcu_exit_critical(void);
@@ -0,0 +1,141 @@
+#include "tuya-capture.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+struct tuya_capture {
+    uint8_t *buf;  // Ring storage
+    size_t   size; // Ring size
+    size_t   head; // Oldest record
+    size_t   used; // Bytes taken by records
+    size_t   wpos; // Where the next appended byte goes
+    size_t   left; // Bytes still to append to the newest record
+};
+
+int tuya_capture_create(tuya_capture_t *cap, size_t size)
+{
+    if (!cap || size <= TUYA_CAPTURE_REC_HDR)
+        return -1;
+
+    *cap = calloc(1, sizeof(struct tuya_capture));
+    if (!*cap)
+        return -1;
+
+    (*cap)->buf = malloc(size);
+    if (!(*cap)->buf) {
+        free(*cap);
+        *cap = NULL;
+        return -1;
+    }
+    (*cap)->size = size;
+    return 0;
+}
+
+void tuya_capture_destroy(tuya_capture_t cap)
+{
+    if (!cap)
+        return;
+
+    free(cap->buf);
+    free(cap);
+}
+
+void tuya_capture_clear(tuya_capture_t cap)
+{
+    cap->head = cap->used = cap->wpos = cap->left = 0;
+}
+
+static void ring_put(tuya_capture_t cap, const uint8_t *data, size_t len)
+{
+    size_t n = cap->size - cap->wpos < len ? cap->size - cap->wpos : len;
+
+    memcpy(cap->buf + cap->wpos, data, n);
+    memcpy(cap->buf, data + n, len - n);
+    cap->wpos = (cap->wpos + len) % cap->size;
+}
+
+static uint8_t ring_at(tuya_capture_t cap, size_t offset)
+{
+    return cap->buf[(cap->head + offset) % cap->size];
+}
+
+void tuya_capture_begin(tuya_capture_t cap, uint32_t tick, uint8_t flags, size_t len)
+{
+    size_t  max = cap->size - TUYA_CAPTURE_REC_HDR;
+    uint8_t hdr[TUYA_CAPTURE_REC_HDR];
+
+    if (max > UINT16_MAX)
+        max = UINT16_MAX;
+    if (len > max) {
+        len = max;
+        flags |= TUYA_CAPTURE_TRUNCATED;
+    }
+    // Drop oldest records until the new one fits
+    while (cap->size - cap->used < TUYA_CAPTURE_REC_HDR + len) {
+        size_t old = TUYA_CAPTURE_REC_HDR + (ring_at(cap, 5) | (ring_at(cap, 6) << 8));
+        cap->head = (cap->head + old) % cap->size;
+        cap->used -= old;
+    }
+
+    hdr[0] = tick & 0xFF;
+    hdr[1] = (tick >> 8) & 0xFF;
+    hdr[2] = (tick >> 16) & 0xFF;
+    hdr[3] = (tick >> 24) & 0xFF;
+    hdr[4] = flags;
+    hdr[5] = len & 0xFF;
+    hdr[6] = (len >> 8) & 0xFF;
+    ring_put(cap, hdr, sizeof(hdr));
+    cap->used += TUYA_CAPTURE_REC_HDR + len;
+    cap->left = len;
+}
+
+void tuya_capture_append(tuya_capture_t cap, const uint8_t *data, size_t len)
+{
+    if (len > cap->left)
+        len = cap->left; // Truncated record
+    ring_put(cap, data, len);
+    cap->left -= len;
+}
+
+int tuya_capture_dump(tuya_capture_t cap, tuya_capture_write_t write, void *arg)
+{
+    uint8_t hdr[TUYA_CAPTURE_FILE_HDR] = { 'T', 'Y', 'C', 'P', TUYA_CAPTURE_VERSION };
+    size_t  n = cap->size - cap->head < cap->used ? cap->size - cap->head : cap->used;
+
+    if (write(arg, hdr, sizeof(hdr)) < 0)
+        return -1;
+    if (n > 0 && write(arg, cap->buf + cap->head, n) < 0)
+        return -1;
+    if (cap->used > n && write(arg, cap->buf, cap->used - n) < 0)
+        return -1;
+    return 0;
+}
+
+int tuya_capture_open(const uint8_t *dump, size_t len, size_t *pos)
+{
+    if (len < TUYA_CAPTURE_FILE_HDR || memcmp(dump, TUYA_CAPTURE_MAGIC, 4) != 0 ||
+        dump[4] != TUYA_CAPTURE_VERSION)
+        return -1;
+
+    *pos = TUYA_CAPTURE_FILE_HDR;
+    return 0;
+}
+
+int tuya_capture_next(const uint8_t *dump, size_t len, size_t *pos, tuya_capture_rec_t *rec)
+{
+    const uint8_t *hdr = dump + *pos;
+
+    if (*pos == len)
+        return 0;
+    if (len - *pos < TUYA_CAPTURE_REC_HDR)
+        return -1;
+
+    rec->tick = hdr[0] | (hdr[1] << 8) | (hdr[2] << 16) | ((uint32_t)hdr[3] << 24);
+    rec->flags = hdr[4];
+    rec->len = hdr[5] | (hdr[6] << 8);
+    if (len - *pos - TUYA_CAPTURE_REC_HDR < rec->len)
+        return -1;
+    rec->data = hdr + TUYA_CAPTURE_REC_HDR;
+    *pos += TUYA_CAPTURE_REC_HDR + rec->len;
+    return 1;
+}
@@ -0,0 +1,48 @@
+#pragma once
+
+#include <stdbool.h>
+#include <inttypes.h>
+#include <stddef.h>
+
+/*
+ * Capture format, all fields little endian:
+ *   file header: "TYCP", version (1 byte), 3 reserved bytes
+ *   record:      tick (4 bytes), flags (1 byte), length (2 bytes), data
+ * Rx records hold bytes as the UART returned them, noise and partial frames
+ * included, so a replay goes through the same parser states. Tx records hold
+ * one whole frame each.
+ */
+#define TUYA_CAPTURE_MAGIC       "TYCP"
+#define TUYA_CAPTURE_VERSION     1
+#define TUYA_CAPTURE_FILE_HDR    8
+#define TUYA_CAPTURE_REC_HDR     7
+#define TUYA_CAPTURE_RX          0        // Received from the MCU
+#define TUYA_CAPTURE_TX          (1 << 0) // Sent by us
+#define TUYA_CAPTURE_TRUNCATED   (1 << 1) // Record holds only the start of the data
+
+typedef struct tuya_capture *tuya_capture_t;
+
+typedef struct {
+    uint32_t       tick;  // tuya_mcu_now at capture time
+    uint8_t        flags; // TUYA_CAPTURE_*
+    uint16_t       len;   // Bytes in data
+    const uint8_t *data;  // Record data, points into the dump
+} tuya_capture_rec_t;
+
+/* Write len bytes of a dump, returns <0 to stop */
+typedef int (*tuya_capture_write_t)(void *arg, const uint8_t *data, size_t len);
+
+int  tuya_capture_create(tuya_capture_t *cap, size_t size);
+void tuya_capture_destroy(tuya_capture_t cap);
+void tuya_capture_clear(tuya_capture_t cap);
+
+/* Record len bytes given in one or more appends, oldest records make room */
+void tuya_capture_begin(tuya_capture_t cap, uint32_t tick, uint8_t flags, size_t len);
+void tuya_capture_append(tuya_capture_t cap, const uint8_t *data, size_t len);
+
+/* Write file header and all records, oldest first */
+int tuya_capture_dump(tuya_capture_t cap, tuya_capture_write_t write, void *arg);
+
+/* Walk a dump: check the header, then read records until 0 (end) or <0 (corrupt) */
+int tuya_capture_open(const uint8_t *dump, size_t len, size_t *pos);
+int tuya_capture_next(const uint8_t *dump, size_t len, size_t *pos, tuya_capture_rec_t *rec);
@@ -0,0 +1,181 @@
+#include "tuya-dp-pool.h"
+#include "platform.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+typedef union tuya_dp_chunk {
+    union tuya_dp_chunk *next;                     // Free list link
+    uint8_t              data[TUYA_DP_CHUNK_SIZE]; // Value
+} tuya_dp_chunk_t;
+
+struct tuya_dp_pool {
+    tuya_dp_rec_t   *records;     // Record storage
+    tuya_dp_chunk_t *chunks;      // Chunk storage
+    tuya_dp_rec_t   *free_recs;   // Free records
+    tuya_dp_chunk_t *free_chunks; // Free chunks
+    size_t           nfree_recs;
+    size_t           nfree_chunks;
+};
+
+/* No locking for single task ports */
+__attribute__((weak)) void tuya_mcu_enter_critical(void)
+{
+}
+
+__attribute__((weak)) void tuya_mcu_exit_critical(void)
+{
+}
+
+int tuya_dp_pool_create(tuya_dp_pool_t *pool, size_t records, size_t chunks)
+{
+    if (!pool || !records)
+        return -1;
+
+    *pool = calloc(1, sizeof(struct tuya_dp_pool));
+    if (!*pool)
+        return -1;
+
+    (*pool)->records = calloc(records, sizeof(tuya_dp_rec_t));
+    (*pool)->chunks = chunks ? calloc(chunks, sizeof(tuya_dp_chunk_t)) : NULL;
+    if (!(*pool)->records || (chunks && !(*pool)->chunks)) {
+        tuya_dp_pool_destroy(*pool);
+        *pool = NULL;
+        return -1;
+    }
+
+    // Thread both storages into free lists
+    for (size_t i = 0; i < records; i++) {
+        (*pool)->records[i].u.next = (*pool)->free_recs;
+        (*pool)->free_recs = &(*pool)->records[i];
+    }
+    for (size_t i = 0; i < chunks; i++) {
+        (*pool)->chunks[i].next = (*pool)->free_chunks;
+        (*pool)->free_chunks = &(*pool)->chunks[i];
+    }
+    (*pool)->nfree_recs = records;
+    (*pool)->nfree_chunks = chunks;
+    return 0;
+}
+
+void tuya_dp_pool_destroy(tuya_dp_pool_t pool)
+{
+    if (!pool)
+        return;
+
+    free(pool->records);
+    free(pool->chunks);
+    free(pool);
+}
+
+tuya_dp_ref_t tuya_dp_pool_alloc(tuya_dp_pool_t pool, const tuya_dp_view_t *view)
+{
+    tuya_dp_rec_t   *rec = NULL;
+    tuya_dp_chunk_t *chunk = NULL;
+    bool             large;
+
+    if (!pool || !view || view->len > TUYA_DP_CHUNK_SIZE)
+        return NULL;
+
+    large = view->len > TUYA_DP_INLINE_SIZE;
+    tuya_mcu_enter_critical();
+    if (pool->free_recs && (!large || pool->free_chunks)) {
+        rec = pool->free_recs;
+        pool->free_recs = rec->u.next;
+        pool->nfree_recs--;
+        if (large) {
+            chunk = pool->free_chunks;
+            pool->free_chunks = chunk->next;
+            pool->nfree_chunks--;
+        }
+    }
+    tuya_mcu_exit_critical();
+    if (!rec)
+        return NULL;
+
+    rec->id = view->id;
+    rec->type = view->type;
+    rec->len = (uint8_t)view->len;
+    rec->refs = 1;
+    if (large)
+        rec->u.chunk = chunk->data;
+    memcpy(large ? rec->u.chunk : rec->u.value, view->value, view->len);
+    return rec;
+}
+
+tuya_dp_ref_t tuya_dp_pool_alloc_dp(tuya_dp_pool_t pool, const tuya_dp_t *dp)
+{
+    uint8_t        buf[4 + sizeof(dp->data)];
+    tuya_dp_iter_t it;
+    tuya_dp_view_t view;
+
+    // Go through wire format, tuya_dp_t keeps host and wire values in one union
+    int len = tuya_dp_serialize(dp, buf, sizeof(buf));
+    if (len < 0)
+        return NULL;
+
+    tuya_dp_iter_init(&it, buf, len);
+    if (tuya_dp_iter_next(&it, &view) <= 0)
+        return NULL;
+    return tuya_dp_pool_alloc(pool, &view);
+}
+
+tuya_dp_ref_t tuya_dp_pool_retain(tuya_dp_pool_t pool, tuya_dp_ref_t ref)
+{
+    if (!pool || !ref)
+        return NULL;
+
+    tuya_mcu_enter_critical();
+    if (ref->refs == UINT8_MAX)
+        ref = NULL; // Too many holders
+    else
+        ref->refs++;
+    tuya_mcu_exit_critical();
+    return ref;
+}
+
+/* Drop one reference, record goes back to the pool with the last one */
+void tuya_dp_pool_release(tuya_dp_pool_t pool, tuya_dp_ref_t ref)
+{
+    if (!pool || !ref)
+        return;
+
+    tuya_mcu_enter_critical();
+    if (--ref->refs > 0) {
+        tuya_mcu_exit_critical();
+        return;
+    }
+    if (ref->len > TUYA_DP_INLINE_SIZE) {
+        tuya_dp_chunk_t *chunk = (tuya_dp_chunk_t *)ref->u.chunk;
+        chunk->next = pool->free_chunks;
+        pool->free_chunks = chunk;
+        pool->nfree_chunks++;
+    }
+    ref->u.next = pool->free_recs;
+    pool->free_recs = ref;
+    pool->nfree_recs++;
+    tuya_mcu_exit_critical();
+}
+
+size_t tuya_dp_pool_free_records(tuya_dp_pool_t pool)
+{
+    return pool ? pool->nfree_recs : 0;
+}
+
+size_t tuya_dp_pool_free_chunks(tuya_dp_pool_t pool)
+{
+    return pool ? pool->nfree_chunks : 0;
+}
+
+const uint8_t *tuya_dp_ref_value(tuya_dp_ref_t ref)
+{
+    return ref->len > TUYA_DP_INLINE_SIZE ? ref->u.chunk : ref->u.value;
+}
+
+void tuya_dp_ref_view(tuya_dp_ref_t ref, tuya_dp_view_t *view)
+{
+    view->id = ref->id;
+    view->type = ref->type;
+    view->len = ref->len;
+    view->value = tuya_dp_ref_value(ref);
+}
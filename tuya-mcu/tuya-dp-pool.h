@@ -0,0 +1,39 @@
+#pragma once
+
+#include <stdbool.h>
+#include <inttypes.h>
+#include <stddef.h>
+
+#include "tuya-dp.h"
+
+#define TUYA_DP_INLINE_SIZE 8 // Values up to this size are stored in the record itself
+#define TUYA_DP_CHUNK_SIZE 64 // Larger values go to a pooled chunk, this is the max value size
+
+/* Compact data point, moved around by handle (tuya_dp_ref_t) and reference counted */
+typedef struct tuya_dp_rec {
+    uint8_t id;       // Data point ID
+    uint8_t type;     // Data point type
+    uint8_t len;      // Length of data point value
+    uint8_t refs;     // Reference count
+    union {
+        uint8_t             value[TUYA_DP_INLINE_SIZE]; // Small value in wire format
+        uint8_t            *chunk;                      // Large value in wire format
+        struct tuya_dp_rec *next;                       // Free list link
+    } u;
+} tuya_dp_rec_t;
+
+typedef tuya_dp_rec_t      *tuya_dp_ref_t;
+typedef struct tuya_dp_pool *tuya_dp_pool_t;
+
+int  tuya_dp_pool_create(tuya_dp_pool_t *pool, size_t records, size_t chunks);
+void tuya_dp_pool_destroy(tuya_dp_pool_t pool);
+
+tuya_dp_ref_t tuya_dp_pool_alloc(tuya_dp_pool_t pool, const tuya_dp_view_t *view);
+tuya_dp_ref_t tuya_dp_pool_alloc_dp(tuya_dp_pool_t pool, const tuya_dp_t *dp);
+tuya_dp_ref_t tuya_dp_pool_retain(tuya_dp_pool_t pool, tuya_dp_ref_t ref);
+void          tuya_dp_pool_release(tuya_dp_pool_t pool, tuya_dp_ref_t ref);
+size_t        tuya_dp_pool_free_records(tuya_dp_pool_t pool);
+size_t        tuya_dp_pool_free_chunks(tuya_dp_pool_t pool);
+
+const uint8_t *tuya_dp_ref_value(tuya_dp_ref_t ref);
+void           tuya_dp_ref_view(tuya_dp_ref_t ref, tuya_dp_view_t *view);
@@ -134,40 +134,82 @@ int tuya_dp_serialize(const tuya_dp_t *dp, uint8_t *out_buf, size_t out_len)
     return (int)total_len;
 }
 
-int parse_tuya_dp(const uint8_t *buf, size_t buf_len, tuya_dp_t *dp)
+//-----------------------------
+// Iterator functions
+//-----------------------------
+void tuya_dp_iter_init(tuya_dp_iter_t *it, const uint8_t *data, size_t len)
 {
-    if (!buf || !dp || buf_len < 4) {
-        return -1; // Invalid input
-    }
+    it->pos = data;
+    it->end = data ? data + len : NULL;
+}
 
-    dp->id = buf[0];
-    dp->type = buf[1];
-    dp->len = (uint16_t)((buf[2] << 8) | buf[3]); // Big endian
+/* Returns 1 with view filled, 0 at end of payload, -1 on malformed data point */
+int tuya_dp_iter_next(tuya_dp_iter_t *it, tuya_dp_view_t *view)
+{
+    if (!it || !view)
+        return -1;
 
-    if (dp->len > sizeof(dp->data.raw)) {
-        return -1; // Too large for struct
+    size_t left = it->end - it->pos;
+    if (left == 0)
+        return 0;
+
+    if (left < 4) {
+        it->pos = it->end;
+        return -1; // Truncated header
     }
 
-    if (buf_len < 4 + dp->len) {
+    view->id = it->pos[0];
+    view->type = it->pos[1];
+    view->len = (uint16_t)((it->pos[2] << 8) | it->pos[3]); // Big endian
+    if (left - 4 < view->len) {
+        it->pos = it->end;
         return -1; // Not enough data
     }
+    view->value = it->pos + 4;
+    it->pos += 4 + view->len;
+    return 1;
+}
+
+bool tuya_dp_view_get_bool(const tuya_dp_view_t *view)
+{
+    return view->len > 0 && view->value[0] != 0;
+}
+
+int32_t tuya_dp_view_get_value(const tuya_dp_view_t *view)
+{
+    // Tuya values are 4-byte big-endian integers
+    if (view->len < 4)
+        return 0;
+
+    return (int32_t)(((uint32_t)view->value[0] << 24) | ((uint32_t)view->value[1] << 16) |
+                     ((uint32_t)view->value[2] << 8) | ((uint32_t)view->value[3]));
+}
+
+int tuya_dp_from_view(tuya_dp_t *dp, const tuya_dp_view_t *view)
+{
+    if (!dp || !view)
+        return -1;
+
+    if (view->len > sizeof(dp->data.raw)) {
+        return -1; // Too large for struct
+    }
+
+    dp->id = view->id;
+    dp->type = view->type;
+    dp->len = view->len;
 
     // Copy raw bytes
-    memcpy(dp->data.raw, buf + 4, dp->len);
+    memcpy(dp->data.raw, view->value, dp->len);
 
     // Interpret according to DP type
     switch (dp->type) {
     case DP_TYPE_BOOL:
-        dp->data.boolean = (dp->data.raw[0] != 0);
+        dp->data.boolean = tuya_dp_view_get_bool(view);
         break;
 
     case DP_TYPE_VALUE:
-        // Tuya values are 4-byte big-endian integers
-        if (dp->len >= 4) {
-            dp->data.value =
-                (int32_t)(((uint32_t)dp->data.raw[0] << 24) | ((uint32_t)dp->data.raw[1] << 16) |
-                          ((uint32_t)dp->data.raw[2] << 8) | ((uint32_t)dp->data.raw[3]));
-        }
+        if (dp->len >= 4)
+            dp->data.value = tuya_dp_view_get_value(view);
         break;
 
     case DP_TYPE_STRING:
@@ -195,6 +237,45 @@ int parse_tuya_dp(const uint8_t *buf, size_t buf_len, tuya_dp_t *dp)
     return 0;
 }
 
+int tuya_dp_view_serialize(const tuya_dp_view_t *view, uint8_t *out_buf, size_t out_len)
+{
+    if (!view || !out_buf || out_len < 4 + (size_t)view->len)
+        return -1;
+
+    out_buf[0] = view->id;
+    out_buf[1] = view->type;
+    out_buf[2] = (view->len >> 8) & 0xFF; // LEN_H (big-endian)
+    out_buf[3] = view->len & 0xFF;        // LEN_L
+    memcpy(&out_buf[4], view->value, view->len);
+    return 4 + view->len;
+}
+
+uint32_t tuya_dp_view_hash(const tuya_dp_view_t *view)
+{
+    uint32_t hash = 2166136261u;
+
+    hash = (hash ^ view->type) * 16777619u;
+    for (uint16_t i = 0; i < view->len; i++)
+        hash = (hash ^ view->value[i]) * 16777619u;
+    return hash;
+}
+
+int parse_tuya_dp(const uint8_t *buf, size_t buf_len, tuya_dp_t *dp)
+{
+    tuya_dp_iter_t it;
+    tuya_dp_view_t view;
+
+    if (!buf || !dp) {
+        return -1; // Invalid input
+    }
+
+    tuya_dp_iter_init(&it, buf, buf_len);
+    if (tuya_dp_iter_next(&it, &view) <= 0)
+        return -1;
+
+    return tuya_dp_from_view(dp, &view);
+}
+
 int tuya_dp_print(tuya_dp_t *dp)
 {
     static const char *type_str[] = {
@@ -19,6 +19,18 @@ typedef struct {
     } data;                // Data point value
 } tuya_dp_t;
 
+typedef struct {
+    uint8_t        id;    // Data point ID
+    uint8_t        type;  // Data point type
+    uint16_t       len;   // Length of data point value
+    const uint8_t *value; // Value in wire format (big endian), points into the frame
+} tuya_dp_view_t;
+
+typedef struct {
+    const uint8_t *pos; // Next data point
+    const uint8_t *end; // End of payload
+} tuya_dp_iter_t;
+
 void     tuya_dp_set_raw(tuya_dp_t *dp, uint8_t id, const uint8_t *buf, uint16_t len);
 void     tuya_dp_set_bool(tuya_dp_t *dp, uint8_t id, bool value);
 void     tuya_dp_set_value(tuya_dp_t *dp, uint8_t id, int32_t value);
@@ -29,4 +41,15 @@ uint16_t tuya_dp_get_len(const tuya_dp_t *dp);
 int      tuya_dp_serialize(const tuya_dp_t *dp, uint8_t *out_buf, size_t out_len);
 
 int parse_tuya_dp(const uint8_t *data, size_t len, tuya_dp_t *dp);
+
+// Zero-copy iteration over the data points of a payload
+void    tuya_dp_iter_init(tuya_dp_iter_t *it, const uint8_t *data, size_t len);
+int     tuya_dp_iter_next(tuya_dp_iter_t *it, tuya_dp_view_t *view);
+int     tuya_dp_from_view(tuya_dp_t *dp, const tuya_dp_view_t *view);
+int     tuya_dp_view_serialize(const tuya_dp_view_t *view, uint8_t *out_buf, size_t out_len);
+bool    tuya_dp_view_get_bool(const tuya_dp_view_t *view);
+int32_t tuya_dp_view_get_value(const tuya_dp_view_t *view);
+// FNV-1a of type and value, tells a written value from its echo without keeping a copy
+uint32_t tuya_dp_view_hash(const tuya_dp_view_t *view);
+
 int tuya_dp_print(tuya_dp_t *dp);
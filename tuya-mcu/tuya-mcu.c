@@ -1,25 +1,108 @@
 #include "tuya-mcu.h"
 #include "platform.h"
 
-#include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
 #include <stdbool.h>
 #include <ctype.h>
 
-#define PID_LEN 16 // Product ID length
-#define VER_LEN 5  // Version length
-
 #define RX_BUF_SIZE 256
 #define TX_BUF_SIZE 256
 
+#define DP_ID_COUNT 256 // DP ids are one byte
+
+#define CMD_COUNT 256 // Commands are one byte
+#define CMD_SLOTS 24  // Commands with a handler, built-in ones included
+
+#define SYNC_WINDOW_MAX      8    // Max synchronous reports awaiting completion
+#define SYNC_DEFAULT_TIMEOUT 5000 // ms before an uncompleted report is failed
+
+enum tuya_sync_state {
+    SYNC_PENDING = 0,
+    SYNC_SUCCEEDED,
+    SYNC_FAILED,
+};
+
+struct tuya_sync_report {
+    uint16_t id;    // Report id given to the application
+    uint8_t  state; // enum tuya_sync_state
+    uint32_t start; // Receive timestamp
+};
+
+#define DP_WRITE_SLOTS           8    // Max DP writes awaiting their echo
+#define DP_WRITE_DEFAULT_TIMEOUT 2000 // ms before a DP write is given up
+
+struct tuya_dp_write {
+    tuya_mcu_dp_write_cb_t cb;   // Completion callback, NULL if slot is free
+    void                  *arg;  // Argument for callback
+    uint32_t               sent; // Send timestamp
+    uint32_t               hash; // tuya_dp_view_hash of the value written
+    uint8_t                id;   // DP id the echo is expected for
+};
+
+struct tuya_dp_sent {
+    uint32_t at;   // Send timestamp
+    uint32_t hash; // tuya_dp_view_hash of the value
+};
+
+#define HEARTBEAT_REPLY_TIMEOUT 1000 // ms for the MCU to answer a heartbeat once initialized
+
+#define HANDSHAKE_HEARTBEAT_PERIOD 1000 // ms between heartbeats until the MCU answers
+#define HANDSHAKE_QUERY_PERIOD     5000 // ms between product info queries
+
+#define BAUD_PROBE_INTERVAL  250 // Default ms to wait for a heartbeat answer at each rate
+#define BAUD_SWITCH_INTERVAL 100 // ms between heartbeats while a switch is verified
+
+enum tuya_baud_state {
+    BAUD_FIXED = 0, // Rate locked or never probed
+    BAUD_PROBING,   // Trying rates until the MCU answers
+    BAUD_SWITCHING, // New rate set, waiting for the MCU to answer at it
+};
+
+#define STREAM_HDR_LEN      6      // Stream frame header: id, offset
+#define MAPS_STREAM_HDR_LEN 9      // Map stream frame header: version, id, sub id, attribute, offset
+#define STREAM_FRAME_MAX    0xFFFF // Payload length field limit
+
+enum tuya_stream_status {
+    STREAM_OK = 0x00,
+    STREAM_FAILED = 0x01,
+};
+
+struct tuya_stream_rx {
+    tuya_mcu_stream_hdr_t hdr;      // Frame being received
+    uint32_t              received; // Data bytes of the frame seen so far
+    size_t                left;     // Data bytes still to pass through, passthrough only
+    size_t                len;      // Frame length, passthrough only
+    uint8_t               sum;      // Checksum so far, passthrough only
+    bool                  active;   // Frame is passing through the rx buffer
+    bool                  accept;   // Frame is in sequence and the sink wants it
+    uint16_t              id;       // Stream in progress
+    uint8_t               sub_id;   // Sub-map in progress
+    uint32_t              next;     // Offset expected next
+};
+
+struct tuya_cmd_entry {
+    tuya_mcu_cmd_handler_t handler;
+    void                  *arg;
+};
+
 struct tuya_mcu {
-    char                product_id[PID_LEN + 1]; // Product ID
-    char                version[VER_LEN + 1];    // Version
-    enum tuya_mcu_state state;                   // Device state
-    uint32_t            last_heartbeat;          // Last heartbeat timestamp
-    uint32_t            last_query;              // Last query timestamp
-    bool                heartbeat_received;      // Heartbeat received flag
+    tuya_mcu_product_info_t info;               // Product information
+    enum tuya_mcu_state     state;              // Device state
+    uint32_t                last_heartbeat;     // Last heartbeat timestamp
+    uint32_t                last_query;         // Last query timestamp
+    bool                    heartbeat_received; // Heartbeat received flag
+    uint32_t                fast_start_initial; // First fast start retry interval, 0 if off
+    uint32_t                fast_start_max;     // Fast start retry interval limit
+    uint32_t                fast_start_wait;    // Current retry interval, 0 until the first send
+    uint32_t                fast_start_sent;    // Last fast start send timestamp
+    uint32_t                hb_interval;        // ms of MCU silence before a heartbeat once initialized
+    uint32_t                hb_max_interval;    // Max ms between heartbeats once initialized
+    uint8_t                 hb_max_missed;      // Unanswered heartbeats before resync, 0 never
+    uint8_t                 hb_missed;          // Heartbeats unanswered in a row
+    bool                    hb_waiting;         // Heartbeat sent once initialized, no frame since
+    bool                    rx_seen;            // Valid frame received since the last tick
+    uint32_t                last_rx;            // Tick a valid frame was last seen at
 
     tuya_mcu_state_handler_t state_handler;     // State handler
     void                    *state_handler_arg; // Argument for state handler
@@ -30,13 +113,80 @@ struct tuya_mcu {
     tuya_mcu_dp_handler_t dp_handler;     // Data point handler
     void                 *dp_handler_arg; // Argument for data point handler
 
-    void   *uart_context;
-    uint8_t rx_buf[RX_BUF_SIZE];
-    uint8_t tx_buf[TX_BUF_SIZE];
-    size_t  rx_pos;
-    size_t  tx_pos;
+    tuya_mcu_dp_batch_handler_t dp_batch_handler;     // Data point batch handler
+    void                       *dp_batch_handler_arg; // Argument for data point batch handler
+
+    uint8_t               cmd_slot[CMD_COUNT];  // Handler slot + 1 per command, 0 if unhandled
+    struct tuya_cmd_entry cmd_table[CMD_SLOTS]; // Command handlers
+    uint8_t               cmd_slots_used;       // Slots taken in cmd_table
+
+    tuya_mcu_sync_report_handler_t sync_handler;                   // Synchronous report handler
+    tuya_mcu_sync_done_cb_t        sync_done_cb;                   // Synchronous report completion callback
+    void                          *sync_handler_arg;               // Argument for both
+    struct tuya_sync_report        sync_reports[SYNC_WINDOW_MAX];  // Reports in receive order
+    uint8_t                        sync_head;                      // Oldest report
+    uint8_t                        sync_count;                     // Reports awaiting their reply
+    uint8_t                        sync_window;                    // Max reports awaiting their reply
+    uint16_t                       sync_next_id;                   // Id of next report
+    uint32_t                       sync_timeout;                   // ms before a report is failed
+
+    struct tuya_dp_write dp_writes[DP_WRITE_SLOTS]; // DP writes awaiting their echo
+    uint8_t              dp_writes_used;            // Slots taken in dp_writes
+    uint32_t             dp_write_timeout;          // ms before a DP write is given up
+
+    tuya_mcu_baud_handler_t baud_handler;                        // Baud rate lock and switch handler
+    void                   *baud_handler_arg;                    // Argument for baud handler
+    uint32_t                baud_rates[TUYA_MCU_BAUD_RATES_MAX]; // Rates to probe
+    uint8_t                 baud_count;                          // Rates in baud_rates
+    uint8_t                 baud_index;                          // Rate being probed
+    uint8_t                 baud_state;                          // enum tuya_baud_state
+    bool                    baud_answered;                       // Valid frame received since the rate was set
+    uint32_t                baud;                                // Current rate, 0 if unknown
+    uint32_t                baud_prev;                           // Rate to go back to if a switch fails
+    uint32_t                baud_start;                          // Rate set timestamp
+    uint32_t                baud_timeout;                        // ms to wait for an answer at the rate
+    uint32_t                baud_last_hb;                        // Last probe heartbeat timestamp
+
+    tuya_mcu_stream_sink_t stream_sink; // Stream data sink
+    tuya_mcu_stream_done_t stream_done; // Stream frame end callback
+    void                  *stream_arg;  // Argument for both
+    struct tuya_stream_rx  stream;      // Stream receive state
+    uint16_t               stream_max;  // Largest stream frame data length passed through
+
+    tuya_dp_ref_t       *shadow;                          // DP shadow table indexed by DP id, NULL if disabled
+    tuya_dp_pool_t       shadow_pool;                     // Pool holding shadow values
+    struct tuya_dp_sent *shadow_sent;                     // Last write of every DP id, allocated with shadow
+    uint32_t             shadow_pending[DP_ID_COUNT / 32]; // Ids whose last write was not echoed yet
+
+    void    *uart_context;
+    uint8_t  rx_buf[RX_BUF_SIZE];
+    uint8_t  tx_buf[TX_BUF_SIZE];
+    size_t   rx_head;      // Start of unparsed data in rx_buf
+    size_t   rx_tail;      // End of received data in rx_buf
+    size_t   tx_pos;
+
+    tuya_mcu_clock_t clock;     // Time source, NULL for tuya_mcu_get_tick
+    void            *clock_arg; // Argument for clock
+
+    tuya_mcu_stats_t stats;   // Protocol counters
+    tuya_capture_t   capture; // Frame capture ring, NULL if disabled
 };
 
+// Built-in command handlers, registered by tuya_mcu_init
+static int tuya_cmd_heartbeat(tuya_mcu_t mcu, uint8_t ver, uint8_t cmd, const uint8_t *data, size_t len,
+                              void *arg);
+static int tuya_cmd_product_info(tuya_mcu_t mcu, uint8_t ver, uint8_t cmd, const uint8_t *data, size_t len,
+                                 void *arg);
+static int tuya_cmd_wifi_mode(tuya_mcu_t mcu, uint8_t ver, uint8_t cmd, const uint8_t *data, size_t len,
+                              void *arg);
+static int tuya_cmd_state_upload(tuya_mcu_t mcu, uint8_t ver, uint8_t cmd, const uint8_t *data, size_t len,
+                                 void *arg);
+static int tuya_cmd_state_upload_sync(tuya_mcu_t mcu, uint8_t ver, uint8_t cmd, const uint8_t *data, size_t len,
+                                      void *arg);
+static int tuya_cmd_stream(tuya_mcu_t mcu, uint8_t ver, uint8_t cmd, const uint8_t *data, size_t len, void *arg);
+
+static void tuya_link_resync(tuya_mcu_t mcu);
+
 int tuya_mcu_init(tuya_mcu_t *mcu, void *uart_ctx)
 {
     if (!mcu || !uart_ctx)
@@ -48,11 +198,25 @@ int tuya_mcu_init(tuya_mcu_t *mcu, void *uart_ctx)
 
     // Initialize MCU structure
     (*mcu)->state = TUYA_MCU_INIT_HEARTBEAT;
-    memset((*mcu)->product_id, 0, sizeof((*mcu)->product_id));
-    memset((*mcu)->version, 0, sizeof((*mcu)->version));
-    (*mcu)->rx_pos = 0;
+    (*mcu)->rx_head = 0;
+    (*mcu)->rx_tail = 0;
     (*mcu)->tx_pos = 0;
     (*mcu)->uart_context = uart_ctx;
+    (*mcu)->sync_window = SYNC_WINDOW_MAX;
+    (*mcu)->sync_timeout = SYNC_DEFAULT_TIMEOUT;
+    (*mcu)->dp_write_timeout = DP_WRITE_DEFAULT_TIMEOUT;
+    (*mcu)->stream_max = TUYA_MCU_STREAM_MAX_LEN;
+    (*mcu)->hb_interval = TUYA_MCU_HEARTBEAT_INTERVAL;
+    (*mcu)->hb_max_interval = TUYA_MCU_HEARTBEAT_INTERVAL;
+    (*mcu)->hb_max_missed = TUYA_MCU_HEARTBEAT_MAX_MISSED;
+
+    tuya_mcu_register_cmd_handler(*mcu, HEARTBEAT_CMD, tuya_cmd_heartbeat, NULL);
+    tuya_mcu_register_cmd_handler(*mcu, PRODUCT_INFO_CMD, tuya_cmd_product_info, NULL);
+    tuya_mcu_register_cmd_handler(*mcu, WIFI_MODE_CMD, tuya_cmd_wifi_mode, NULL);
+    tuya_mcu_register_cmd_handler(*mcu, STATE_UPLOAD_CMD, tuya_cmd_state_upload, NULL);
+    tuya_mcu_register_cmd_handler(*mcu, STATE_UPLOAD_SYN_CMD, tuya_cmd_state_upload_sync, NULL);
+    tuya_mcu_register_cmd_handler(*mcu, STREAM_TRANS_CMD, tuya_cmd_stream, NULL);
+    tuya_mcu_register_cmd_handler(*mcu, MAPS_STREAM_TRANS_CMD, tuya_cmd_stream, NULL);
     return 0;
 }
 
@@ -61,17 +225,125 @@ int tuya_mcu_deinit(tuya_mcu_t mcu)
     if (!mcu)
         return -1;
 
+    if (mcu->shadow) {
+        for (int i = 0; i < DP_ID_COUNT; i++)
+            tuya_dp_pool_release(mcu->shadow_pool, mcu->shadow[i]);
+        free(mcu->shadow);
+        free(mcu->shadow_sent);
+    }
+    tuya_capture_destroy(mcu->capture);
     free(mcu);
     return 0;
 }
 
 char *tuya_mcu_get_product_id(tuya_mcu_t mcu)
 {
-    return mcu->product_id;
+    return mcu->info.product_id;
 }
 char *tuya_mcu_get_version(tuya_mcu_t mcu)
 {
-    return mcu->version;
+    return mcu->info.version;
+}
+const tuya_mcu_product_info_t *tuya_mcu_get_product_info(tuya_mcu_t mcu)
+{
+    return &mcu->info;
+}
+
+uint32_t tuya_mcu_get_rx_discarded(tuya_mcu_t mcu)
+{
+    return mcu->stats.rx_discarded;
+}
+
+const tuya_mcu_stats_t *tuya_mcu_get_stats(tuya_mcu_t mcu)
+{
+    return &mcu->stats;
+}
+
+void tuya_mcu_reset_stats(tuya_mcu_t mcu)
+{
+    memset(&mcu->stats, 0, sizeof(mcu->stats));
+}
+
+int tuya_mcu_enable_capture(tuya_mcu_t mcu, size_t size)
+{
+    if (!mcu || mcu->capture)
+        return -1;
+    return tuya_capture_create(&mcu->capture, size);
+}
+
+void tuya_mcu_disable_capture(tuya_mcu_t mcu)
+{
+    if (!mcu)
+        return;
+
+    tuya_capture_destroy(mcu->capture);
+    mcu->capture = NULL;
+}
+
+int tuya_mcu_dump_capture(tuya_mcu_t mcu, tuya_capture_write_t write, void *arg)
+{
+    if (!mcu || !mcu->capture || !write)
+        return -1;
+    return tuya_capture_dump(mcu->capture, write, arg);
+}
+
+int tuya_mcu_set_clock(tuya_mcu_t mcu, tuya_mcu_clock_t clock, void *arg)
+{
+    if (!mcu)
+        return -1;
+
+    mcu->clock = clock;
+    mcu->clock_arg = arg;
+    return 0;
+}
+
+uint32_t tuya_mcu_now(tuya_mcu_t mcu)
+{
+    return mcu->clock ? mcu->clock(mcu->clock_arg) : tuya_mcu_get_tick();
+}
+
+/* Shorten next to the time left until at, 0 once it passed */
+static void tuya_deadline_min(uint32_t *next, uint32_t at, uint32_t now)
+{
+    uint32_t left = (int32_t)(at - now) > 0 ? at - now : 0;
+
+    if (left < *next)
+        *next = left;
+}
+
+void tuya_mcu_hist_add(uint32_t *hist, uint32_t value)
+{
+    uint8_t bucket = value ? 32 - __builtin_clz(value) : 0;
+    hist[bucket < TUYA_MCU_HIST_BUCKETS ? bucket : TUYA_MCU_HIST_BUCKETS - 1]++;
+}
+
+static void tuya_stats_count(tuya_mcu_cmd_stats_t *table, uint8_t cmd, size_t frame_len)
+{
+    tuya_mcu_cmd_stats_t *entry = &table[cmd < TUYA_MCU_STATS_CMDS ? cmd : TUYA_MCU_STATS_CMDS];
+    entry->frames++;
+    entry->bytes += frame_len;
+}
+
+int tuya_mcu_set_heartbeat(tuya_mcu_t mcu, uint32_t interval_ms, uint32_t max_interval_ms, uint8_t max_missed)
+{
+    if (!mcu || !interval_ms || max_interval_ms < interval_ms)
+        return -1;
+
+    mcu->hb_interval = interval_ms;
+    mcu->hb_max_interval = max_interval_ms;
+    mcu->hb_max_missed = max_missed;
+    return 0;
+}
+
+int tuya_mcu_set_fast_start(tuya_mcu_t mcu, uint32_t initial_ms, uint32_t max_ms)
+{
+    if (!mcu || (initial_ms && max_ms < initial_ms))
+        return -1;
+
+    mcu->fast_start_initial = initial_ms;
+    mcu->fast_start_max = max_ms;
+    mcu->fast_start_wait = 0;
+    return 0;
 }
 
 int tuya_mcu_set_state_handler(tuya_mcu_t mcu, tuya_mcu_state_handler_t handler, void *arg)
@@ -104,7 +376,44 @@ int tuya_mcu_set_dp_handler(tuya_mcu_t mcu, tuya_mcu_dp_handler_t handler, void
     return 0;
 }
 
-static uint8_t get_check_sum(uint8_t *pack, size_t pack_len)
+int tuya_mcu_set_dp_batch_handler(tuya_mcu_t mcu, tuya_mcu_dp_batch_handler_t handler, void *arg)
+{
+    if (!mcu || !handler)
+        return -1;
+
+    mcu->dp_batch_handler = handler;
+    mcu->dp_batch_handler_arg = arg;
+    return 0;
+}
+
+/* Millisecond resolution is all a platform without a fine clock gets */
+__attribute__((weak)) uint32_t tuya_mcu_get_time_us(void)
+{
+    return tuya_mcu_get_tick() * 1000;
+}
+
+/* Byte-wise fallback for platforms without a bulk read */
+__attribute__((weak)) int tuya_mcu_uart_read(void *ctx, uint8_t *buf, size_t len, uint32_t timeout_ms)
+{
+    size_t i;
+    int    n = 0;
+
+    for (i = 0; i < len && (n = tuya_mcu_uart_rx(ctx, buf + i)) > 0; i++)
+        ;
+    return (i == 0 && n < 0) ? n : (int)i;
+}
+
+/* Byte-wise fallback for platforms without a bulk write */
+__attribute__((weak)) int tuya_mcu_uart_write(void *ctx, const uint8_t *buf, size_t len)
+{
+    for (size_t i = 0; i < len; i++) {
+        if (tuya_mcu_uart_tx(ctx, buf[i]) < 0)
+            return -1;
+    }
+    return (int)len;
+}
+
+static uint8_t get_check_sum(const uint8_t *pack, size_t pack_len)
 {
     int     i;
     uint8_t check_sum = 0;
@@ -115,120 +424,143 @@ static uint8_t get_check_sum(uint8_t *pack, size_t pack_len)
     return check_sum;
 }
 
-void print_hex(const unsigned char *buf, int len)
+static const char *info_skip_blank(const char *pos, const char *end)
 {
-    for (int i = 0; i < len; ++i)
-        printf("%02X ", buf[i]);
-    printf("\n");
+    while (pos < end && isspace((unsigned char)*pos))
+        pos++;
+    return pos;
 }
 
-int parse_product_info(tuya_mcu_t mcu, const char *data, size_t len)
+static void info_copy_str(char *dst, size_t size, const char *src, size_t len)
 {
-    char buf[256];
-    if (len >= sizeof(buf))
-        len = sizeof(buf) - 1;
-
-    memcpy(buf, data, len);
-    buf[len] = 0;
-
-    // Extract fields
-    char p[64] = { 0 }, v[32] = { 0 }, ir[32] = { 0 };
-    int  m = -1, mt = -1, n = -1, low = -1;
-    int  found_pid = 0, found_ver = 0;
-
-    // Product ID
-    char *found = strstr(buf, "\"p\":");
-    if (found) {
-        char *start = strchr(found + 3, '"');
-        if (start) {
-            start++;
-            char *end = strchr(start, '"');
-            if (end && end - start < (int)sizeof(p)) {
-                strncpy(p, start, end - start);
-                p[end - start] = 0;
-                found_pid = 1;
-                strncpy(mcu->product_id, p, PID_LEN);
-                mcu->product_id[PID_LEN] = 0;
-            }
-        }
+    if (len >= size)
+        len = size - 1;
+    memcpy(dst, src, len);
+    dst[len] = 0;
+}
+
+// Numbers may come bare, quoted or as true/false
+static bool info_parse_uint(const char *src, size_t len, uint32_t *val)
+{
+    if (len == 4 && !memcmp(src, "true", 4)) {
+        *val = 1;
+        return true;
     }
+    if (len == 5 && !memcmp(src, "false", 5)) {
+        *val = 0;
+        return true;
+    }
+    if (!len)
+        return false;
 
-    // Version
-    found = strstr(buf, "\"v\":");
-    if (found) {
-        char *start = strchr(found + 3, '"');
-        if (start) {
-            start++;
-            char *end = strchr(start, '"');
-            if (end && end - start < (int)sizeof(v)) {
-                strncpy(v, start, end - start);
-                v[end - start] = 0;
-                found_ver = 1;
-                strncpy(mcu->version, v, VER_LEN);
-                mcu->version[VER_LEN] = 0;
-            }
-        }
+    *val = 0;
+    for (size_t i = 0; i < len; i++) {
+        if (src[i] < '0' || src[i] > '9')
+            return false;
+        *val = *val * 10 + (src[i] - '0');
     }
+    return true;
+}
 
-    // m
-    found = strstr(buf, "\"m\":");
-    if (found)
-        sscanf(found, "\"m\":%d", &m);
-
-    // mt
-    found = strstr(buf, "\"mt\":");
-    if (found)
-        sscanf(found, "\"mt\":%d", &mt);
-
-    // n
-    found = strstr(buf, "\"n\":");
-    if (found)
-        sscanf(found, "\"n\":%d", &n);
-
-    // ir
-    found = strstr(buf, "\"ir\":");
-    if (found) {
-        char *start = strchr(found + 4, '"');
-        if (start) {
-            start++;
-            char *end = strchr(start, '"');
-            if (end && end - start < (int)sizeof(ir)) {
-                strncpy(ir, start, end - start);
-                ir[end - start] = 0;
-            }
+static void info_set_field(tuya_mcu_product_info_t *info, const char *key, size_t key_len, const char *val,
+                           size_t val_len)
+{
+    uint32_t num = 0;
+    bool     is_num = info_parse_uint(val, val_len, &num);
+
+    switch (key_len) {
+    case 1:
+        if (key[0] == 'p') {
+            info_copy_str(info->product_id, sizeof(info->product_id), val, val_len);
+            info->present |= TUYA_MCU_INFO_PID;
+        } else if (key[0] == 'v') {
+            info_copy_str(info->version, sizeof(info->version), val, val_len);
+            info->present |= TUYA_MCU_INFO_VER;
+        } else if (key[0] == 'm' && is_num) {
+            info->m = num;
+            info->present |= TUYA_MCU_INFO_M;
+        } else if (key[0] == 'n' && is_num) {
+            info->n = num;
+            info->present |= TUYA_MCU_INFO_N;
+        }
+        break;
+    case 2:
+        if (key[0] == 'm' && key[1] == 't' && is_num) {
+            info->mt = num;
+            info->present |= TUYA_MCU_INFO_MT;
+        } else if (key[0] == 'i' && key[1] == 'r') {
+            info_copy_str(info->ir, sizeof(info->ir), val, val_len);
+            info->present |= TUYA_MCU_INFO_IR;
+        }
+        break;
+    case 3:
+        if (!memcmp(key, "low", 3) && is_num) {
+            info->low = num != 0;
+            info->present |= TUYA_MCU_INFO_LOW;
         }
+        break;
+    default:
+        break;
     }
+}
+
+// Walk {"key":value,...} once in place, unknown keys are skipped
+int parse_product_info(tuya_mcu_t mcu, const char *data, size_t len)
+{
+    tuya_mcu_product_info_t *info = &mcu->info;
+    const char              *pos = data;
+    const char              *end = data + len;
+    const char              *key, *val;
+    size_t                   key_len, val_len;
 
-    // low
-    found = strstr(buf, "\"low\":");
-    if (found)
-        sscanf(found, "\"low\":%d", &low);
+    memset(info, 0, sizeof(*info));
+    while (pos < end) {
+        pos = info_skip_blank(pos, end);
+        if (pos < end && (*pos == '{' || *pos == ',')) {
+            pos++;
+            continue;
+        }
+        if (pos >= end || *pos != '"')
+            break;
+
+        // Key
+        key = ++pos;
+        while (pos < end && *pos != '"')
+            pos++;
+        if (pos >= end)
+            break;
+        key_len = pos++ - key;
 
-    // printf("Product Info:\n");
-    // if (p[0])
-    //     printf("  Product ID: %s\n", p);
-    // if (v[0])
-    //     printf("  Version: %s\n", v);
-    // if (m != -1)
-    //     printf("  m: %d\n", m);
-    // if (mt != -1)
-    //     printf("  mt: %d\n", mt);
-    // if (n != -1)
-    //     printf("  n: %d\n", n);
-    // if (ir[0])
-    //     printf("  ir: %s\n", ir);
-    // if (low != -1)
-    //     printf("  low: %d\n", low);
+        pos = info_skip_blank(pos, end);
+        if (pos >= end || *pos != ':')
+            break;
+        pos = info_skip_blank(pos + 1, end);
+        if (pos >= end)
+            break;
+
+        // Value, string or bare token
+        if (*pos == '"') {
+            val = ++pos;
+            while (pos < end && *pos != '"')
+                pos++;
+            if (pos >= end)
+                break;
+            val_len = pos++ - val;
+        } else {
+            val = pos;
+            while (pos < end && *pos != ',' && *pos != '}' && !isspace((unsigned char)*pos))
+                pos++;
+            val_len = pos - val;
+        }
+        info_set_field(info, key, key_len, val, val_len);
+    }
 
-    return (found_pid && found_ver) ? 0 : -1;
+    return (info->present & TUYA_MCU_INFO_PID) && (info->present & TUYA_MCU_INFO_VER) ? 0 : -1;
 }
 
-static int tuya_frame_send(tuya_mcu_t mcu, uint8_t version, uint8_t cmd, const uint8_t *data,
-                           size_t len)
+/* Send a frame whose payload is already in place at tx_buf + DATA_START */
+static int tuya_frame_flush(tuya_mcu_t mcu, uint8_t version, uint8_t cmd, size_t len)
 {
-    if (len > TX_BUF_SIZE - PROTOCOL_HEAD) // 6 bytes header + 1 byte checksum
-        return -1;                         // Data too long
-
     mcu->tx_buf[0] = FRAME_FIRST;
     mcu->tx_buf[1] = FRAME_SECOND;
     mcu->tx_buf[2] = version;
@@ -236,36 +568,87 @@ static int tuya_frame_send(tuya_mcu_t mcu, uint8_t version, uint8_t cmd, const u
     mcu->tx_buf[4] = (len >> 8) & 0xFF; // Length high byte
     mcu->tx_buf[5] = len & 0xFF;        // Length low byte
 
-    memcpy(mcu->tx_buf + 6, data, len);
     mcu->tx_buf[6 + len] = get_check_sum(mcu->tx_buf, 6 + len); // Checksum
 
-    //    printf("TUYA frame tx: ");
-    //    print_hex(mcu->tx_buf, PROTOCOL_HEAD + len);
+    if (mcu->capture) {
+        tuya_capture_begin(mcu->capture, tuya_mcu_now(mcu), TUYA_CAPTURE_TX, PROTOCOL_HEAD + len);
+        tuya_capture_append(mcu->capture, mcu->tx_buf, PROTOCOL_HEAD + len);
+    }
     // Send the frame
-    for (size_t i = 0; i < PROTOCOL_HEAD + len; ++i) {
-        if (tuya_mcu_uart_tx(mcu->uart_context, mcu->tx_buf[i]) < 0) {
-            return -1; // Error sending data
-        }
+    if (tuya_mcu_uart_write(mcu->uart_context, mcu->tx_buf, PROTOCOL_HEAD + len) != PROTOCOL_HEAD + len) {
+        mcu->stats.tx_errors++;
+        return -1; // Error sending data
     }
+
+    tuya_stats_count(mcu->stats.tx, cmd, PROTOCOL_HEAD + len);
     return 0; // Success
 }
 
+static int tuya_frame_send(tuya_mcu_t mcu, uint8_t version, uint8_t cmd, const uint8_t *data,
+                           size_t len)
+{
+    if (len > TX_BUF_SIZE - PROTOCOL_HEAD) // 6 bytes header + 1 byte checksum
+        return -1;                         // Data too long
+
+    if (len > 0)
+        memcpy(mcu->tx_buf + DATA_START, data, len);
+    return tuya_frame_flush(mcu, version, cmd, len);
+}
+
+/* Send a frame whose payload is a header in tx_buf followed by data taken straight from the caller */
+int tuya_mcu_send_frame_gather(tuya_mcu_t mcu, uint8_t cmd, const uint8_t *hdr, size_t hdr_len, const uint8_t *data,
+                               size_t len)
+{
+    size_t  total = hdr_len + len;
+    uint8_t check_sum;
+
+    if (!mcu || (hdr_len > 0 && !hdr) || (len > 0 && !data))
+        return -1;
+    if (total > STREAM_FRAME_MAX || DATA_START + hdr_len > TX_BUF_SIZE)
+        return -1;
+
+    mcu->tx_buf[0] = FRAME_FIRST;
+    mcu->tx_buf[1] = FRAME_SECOND;
+    mcu->tx_buf[2] = MCU_TX_VER;
+    mcu->tx_buf[3] = cmd;
+    mcu->tx_buf[4] = (total >> 8) & 0xFF;
+    mcu->tx_buf[5] = total & 0xFF;
+    memcpy(mcu->tx_buf + DATA_START, hdr, hdr_len);
+    check_sum = get_check_sum(mcu->tx_buf, DATA_START + hdr_len) + get_check_sum(data, len);
+
+    if (mcu->capture) {
+        tuya_capture_begin(mcu->capture, tuya_mcu_now(mcu), TUYA_CAPTURE_TX, PROTOCOL_HEAD + total);
+        tuya_capture_append(mcu->capture, mcu->tx_buf, DATA_START + hdr_len);
+        tuya_capture_append(mcu->capture, data, len);
+        tuya_capture_append(mcu->capture, &check_sum, 1);
+    }
+
+    if (tuya_mcu_uart_write(mcu->uart_context, mcu->tx_buf, DATA_START + hdr_len) != DATA_START + hdr_len ||
+        (len > 0 && tuya_mcu_uart_write(mcu->uart_context, data, len) != len) ||
+        tuya_mcu_uart_write(mcu->uart_context, &check_sum, 1) != 1) {
+        mcu->stats.tx_errors++;
+        return -1;
+    }
+    tuya_stats_count(mcu->stats.tx, cmd, PROTOCOL_HEAD + total);
+    return 0;
+}
+
 static int tuya_frame_send_heartbeat(tuya_mcu_t mcu)
 {
     // Send heartbeat frame
-    mcu->last_heartbeat = tuya_mcu_get_tick();
+    mcu->last_heartbeat = tuya_mcu_now(mcu);
     return tuya_frame_send(mcu, MCU_TX_VER, HEARTBEAT_CMD, NULL, 0);
 }
 static int tuya_frame_query_product_info(tuya_mcu_t mcu)
 {
     // Send product info frame
-    mcu->last_query = tuya_mcu_get_tick();
+    mcu->last_query = tuya_mcu_now(mcu);
     return tuya_frame_send(mcu, MCU_TX_VER, PRODUCT_INFO_CMD, NULL, 0);
 }
 static int tuya_frame_send_wifi_mode_ack(tuya_mcu_t mcu)
 {
     // Send product info frame
-    mcu->last_query = tuya_mcu_get_tick();
+    mcu->last_query = tuya_mcu_now(mcu);
     return tuya_frame_send(mcu, MCU_TX_VER, WIFI_MODE_CMD, NULL, 0);
 }
 
@@ -283,164 +666,1025 @@ static int tuya_mcu_send_state_request(tuya_mcu_t mcu)
 
 int tuya_mcu_send_dp(tuya_mcu_t mcu, tuya_dp_t *dp)
 {
-    uint8_t buf[128];
-    // Send data query frame
-    tuya_dp_serialize(dp, buf, sizeof(buf));
-    return tuya_frame_send(mcu, MCU_TX_VER, DATA_QUERT_CMD, buf, tuya_dp_get_len(dp));
+    return tuya_mcu_send_dps(mcu, dp, 1) < 0 ? -1 : 0;
 }
 
-static int tuya_frame_handle(tuya_mcu_t mcu, uint8_t ver, uint8_t cmd, uint8_t *data, size_t len)
+typedef int (*dp_serialize_fn)(const void *dps, size_t i, uint8_t *out_buf, size_t out_len);
+
+static int serialize_dp(const void *dps, size_t i, uint8_t *out_buf, size_t out_len)
 {
-    // Handle the received frame based on cmd
-    switch (cmd) {
-    case HEARTBEAT_CMD:
-        //printf("Received Heartbeat Frame: ver=0x%02X cmd=0x%02X data=0x%02X\n", ver, cmd, data[0]);
-        if (data[0] == 0x01)
-            mcu->heartbeat_received = true; // Heartbeat received
-        break;
-    case PRODUCT_INFO_CMD:
-        //printf("Received Product Info Frame: ver=0x%02X cmd=0x%02X\n", ver, cmd);
-        parse_product_info(mcu, (const char *)data, len);
-        break;
-    case WORK_MODE_CMD:
-        //printf("Received Work Mode Query Frame: ver=0x%02X cmd=0x%02X\n", ver, cmd);
-        break;
-    case WIFI_STATE_CMD:
-        //printf("Received WiFi State Frame: ver=0x%02X cmd=0x%02X\n", ver, cmd);
-        break;
-    case WIFI_RESET_CMD:
-        //printf("Received WiFi Reset Frame: ver=0x%02X cmd=0 x%02X data= x%02X\n", ver, cmd,data[0]);
-        break;
-    case WIFI_MODE_CMD:
-        // printf("Received WiFi Mode Frame: ver=0x%02X cmd=0x%02X data= x%02X\n", ver, cmd, data[0]);
-        tuya_frame_send_wifi_mode_ack(mcu);
-        if (mcu->config_handler) {
-            mcu->config_handler(mcu, mcu->config_handler_arg);
-        }
-        break;
-    case DATA_QUERT_CMD: {
-        //printf("Received Data Query Frame: ver=0x%02X cmd=0x%02X\n", ver, cmd);
-    } break;
-    case STATE_UPLOAD_CMD: {
-        tuya_dp_t dp;
-        //printf("Received State Upload Frame: ver=0x%02X cmd=0x%02X\n", ver, cmd);
-        if (mcu->dp_handler) {
-            parse_tuya_dp(data, len, &dp);
-            mcu->dp_handler(mcu, &dp, mcu->dp_handler_arg);
-        }
-    } break;
-    case STATE_QUERY_CMD:
-        //printf("Received State Query Frame: ver=0x%02X cmd=0x%02X\n", ver, cmd);
-        break;
-    // Add more cases for other commands as needed
-    default:
-        //printf("Unknown command 0x%02X received\n", cmd);
-        return -1;
-    }
-    return 0; // Success
+    return tuya_dp_serialize((const tuya_dp_t *)dps + i, out_buf, out_len);
 }
 
-static int tuya_frame_receive(tuya_mcu_t mcu)
+static int serialize_view(const void *dps, size_t i, uint8_t *out_buf, size_t out_len)
+{
+    return tuya_dp_view_serialize((const tuya_dp_view_t *)dps + i, out_buf, out_len);
+}
+
+/* Shadow stops matching the id until the MCU echoes what was written */
+static void tuya_shadow_sent(tuya_mcu_t mcu, const uint8_t *dp, size_t len)
 {
-    uint8_t byte;
-    int     n;
+    tuya_dp_view_t view = { .id = dp[0], .type = dp[1], .len = len - 4, .value = dp + 4 };
 
-    while ((n = tuya_mcu_uart_rx(mcu->uart_context, &byte)) > 0) {
-        // Store received byte in buffer
-        if (mcu->rx_pos < RX_BUF_SIZE) {
-            mcu->rx_buf[mcu->rx_pos++] = byte;
-        } else {
-            // Buffer overflow, reset position
-            mcu->rx_pos = 0;
-        }
+    mcu->shadow_sent[view.id].at = tuya_mcu_now(mcu);
+    mcu->shadow_sent[view.id].hash = tuya_dp_view_hash(&view);
+    mcu->shadow_pending[view.id / 32] |= 1u << (view.id % 32);
+}
 
-        // TUYA frame: 0x55 0xAA [version] [cmd] [lenH] [lenL] [data...] [checksum]
-        while (mcu->rx_pos >= 6) {
-            if (mcu->rx_buf[0] != FRAME_FIRST || mcu->rx_buf[1] != FRAME_SECOND) {
-                // Shift buffer left until header found
-                memmove(mcu->rx_buf, mcu->rx_buf + 1, --mcu->rx_pos);
-                continue;
-            }
-            size_t len = (mcu->rx_buf[4] << 8) | mcu->rx_buf[5];
-            size_t frame_len = 6 + len + 1; // header+ver+cmd+lenH+lenL+data+checksum
-            if (mcu->rx_pos < frame_len)
-                break; // Wait for more data
-
-            // Validate checksum
-            uint8_t check_sum = get_check_sum(mcu->rx_buf, 6 + len);
-            if (check_sum == mcu->rx_buf[frame_len - 1]) {
-                unsigned char  version = mcu->rx_buf[2];
-                unsigned char  cmd = mcu->rx_buf[3];
-                unsigned char *data = mcu->rx_buf + 6;
-
-                // printf("TUYA frame rx: ");
-                // print_hex(mcu->rx_buf, PROTOCOL_HEAD + len);
-                tuya_frame_handle(mcu, version, cmd, data, len);
-            } else {
-                return -1; // Checksum error
-            }
-            // Remove processed frame from buffer
-            if (mcu->rx_pos > frame_len) {
-                memmove(mcu->rx_buf, mcu->rx_buf + frame_len, mcu->rx_pos - frame_len);
-                mcu->rx_pos -= frame_len;
-            } else {
-                mcu->rx_pos = 0;
+/* Frame holding DPs first to end - 1 failed to go out */
+static void tuya_dps_unsent(bool *sent, size_t first, size_t end)
+{
+    for (size_t i = first; sent && i < end; i++)
+        sent[i] = false;
+}
+
+static int tuya_frame_send_dps(tuya_mcu_t mcu, dp_serialize_fn serialize, const void *dps, size_t count,
+                               bool *sent)
+{
+    const size_t room = TX_BUF_SIZE - PROTOCOL_HEAD;
+    size_t       len = 0;
+    size_t       first = 0; // First DP of the frame being filled
+    int          frames = 0;
+    int          ret = 0;
+
+    if (!mcu || (!dps && count))
+        return -1;
+    tuya_dps_unsent(sent, 0, count);
+
+    // Serialize DPs straight into tx_buf, one data query frame per full payload
+    for (size_t i = 0; i < count; i++) {
+        int n = serialize(dps, i, mcu->tx_buf + DATA_START + len, room - len);
+        if (n < 0 && len > 0) {
+            // Frame is full, send it and start a new one
+            if (tuya_frame_flush(mcu, MCU_TX_VER, DATA_QUERT_CMD, len) < 0) {
+                tuya_dps_unsent(sent, first, i);
+                return -1;
             }
+            frames++;
+            len = 0;
+            first = i;
+            n = serialize(dps, i, mcu->tx_buf + DATA_START, room);
+        }
+        if (n < 0) {
+            ret = -1; // DP too large for a frame, skip it
+            continue;
         }
+        if (mcu->shadow)
+            tuya_shadow_sent(mcu, mcu->tx_buf + DATA_START + len, n);
+        if (sent)
+            sent[i] = true;
+        len += n;
     }
-    return 0;
+    if (len > 0) {
+        if (tuya_frame_flush(mcu, MCU_TX_VER, DATA_QUERT_CMD, len) < 0) {
+            tuya_dps_unsent(sent, first, count);
+            return -1;
+        }
+        frames++;
+    }
+    return ret < 0 ? ret : frames;
 }
 
-static void tuya_mcu_state_change(tuya_mcu_t mcu, enum tuya_mcu_state new_state)
+int tuya_mcu_send_dps(tuya_mcu_t mcu, const tuya_dp_t *dps, size_t count)
 {
-    if (mcu->state_handler) {
-        mcu->state_handler(mcu, new_state, mcu->state_handler_arg);
-    }
-    mcu->state = new_state;
+    return tuya_frame_send_dps(mcu, serialize_dp, dps, count, NULL);
 }
 
-int tuya_mcu_tick(tuya_mcu_t mcu)
+int tuya_mcu_send_dp_views(tuya_mcu_t mcu, const tuya_dp_view_t *views, size_t count, bool *sent)
 {
-    uint32_t tick = tuya_mcu_get_tick();
-    if (!mcu)
+    return tuya_frame_send_dps(mcu, serialize_view, views, count, sent);
+}
+
+int tuya_mcu_track_dp_write(tuya_mcu_t mcu, const tuya_dp_view_t *view, tuya_mcu_dp_write_cb_t cb, void *arg)
+{
+    if (!mcu || !view || !cb || mcu->dp_writes_used >= DP_WRITE_SLOTS)
         return -1;
 
-    switch (mcu->state) {
-    case TUYA_MCU_INIT_HEARTBEAT:
-        /* should send heartbeat frames every second */
-        if (tick - mcu->last_heartbeat > 1000)
-            tuya_frame_send_heartbeat(mcu);
+    for (int i = 0; i < DP_WRITE_SLOTS; i++) {
+        struct tuya_dp_write *write = &mcu->dp_writes[i];
+        if (write->cb)
+            continue;
+        write->cb = cb;
+        write->arg = arg;
+        write->sent = tuya_mcu_now(mcu);
+        write->hash = tuya_dp_view_hash(view);
+        write->id = view->id;
+        mcu->dp_writes_used++;
+        return 0;
+    }
+    return -1;
+}
 
-        if (mcu->heartbeat_received)
-            tuya_mcu_state_change(mcu, TUYA_MCU_QUERY_INFO);
+int tuya_mcu_set_dp_write_timeout(tuya_mcu_t mcu, uint32_t timeout_ms)
+{
+    if (!mcu || timeout_ms == 0)
+        return -1;
 
-        break;
-    case TUYA_MCU_QUERY_INFO:
-        /* should send product info query every 5 seconds */
-        if (tick - mcu->last_query > 5000)
-            tuya_frame_query_product_info(mcu);
+    mcu->dp_write_timeout = timeout_ms;
+    return 0;
+}
 
-        // Check if we have received product info
-        if (strlen(mcu->product_id) > 0 && strlen(mcu->version) > 0) {
-            tuya_mcu_send_state_request(mcu);
-            tuya_mcu_state_change(mcu, TUYA_MCU_INITIALIZED);
-        }
-        break;
+static void tuya_dp_write_complete(tuya_mcu_t mcu, struct tuya_dp_write *write,
+                                   enum tuya_mcu_dp_write_status status, uint32_t tick)
+{
+    tuya_mcu_dp_write_result_t result = { .id = write->id, .status = status, .rtt_ms = tick - write->sent };
+    tuya_mcu_dp_write_cb_t     cb = write->cb;
 
-    case TUYA_MCU_INITIALIZED:
-        /* should send heartbeat every 15 seconds  */
-        if (tick - mcu->last_heartbeat > 15000)
-            tuya_frame_send_heartbeat(mcu);
+    // Free the slot first, callback may start a new write
+    write->cb = NULL;
+    mcu->dp_writes_used--;
+    cb(mcu, &result, write->arg);
+}
 
-        break;
-    default:
-        break;
+/* Echo of a DP completes the oldest write of that id and value, other reports of the id are no answer */
+static void tuya_dp_write_echo(tuya_mcu_t mcu, const tuya_dp_view_t *view)
+{
+    struct tuya_dp_write *oldest = NULL;
+    uint32_t              tick = tuya_mcu_now(mcu);
+    uint32_t              hash = tuya_dp_view_hash(view);
+
+    for (int i = 0; i < DP_WRITE_SLOTS; i++) {
+        struct tuya_dp_write *write = &mcu->dp_writes[i];
+        if (write->cb && write->id == view->id && write->hash == hash &&
+            (!oldest || tick - write->sent > tick - oldest->sent))
+            oldest = write;
     }
+    if (oldest)
+        tuya_dp_write_complete(mcu, oldest, TUYA_MCU_DP_WRITE_ACKED, tick);
+}
 
-    // Receive data from UART
-    if (tuya_frame_receive(mcu) < 0) {
-        return -1;
+static void tuya_dp_write_expire(tuya_mcu_t mcu, uint32_t tick)
+{
+    for (int i = 0; i < DP_WRITE_SLOTS && mcu->dp_writes_used; i++) {
+        struct tuya_dp_write *write = &mcu->dp_writes[i];
+        if (write->cb && tick - write->sent >= mcu->dp_write_timeout)
+            tuya_dp_write_complete(mcu, write, TUYA_MCU_DP_WRITE_TIMEOUT, tick);
     }
+}
 
+int tuya_mcu_enable_shadow(tuya_mcu_t mcu, tuya_dp_pool_t pool)
+{
+    if (!mcu || !pool)
+        return -1;
+
+    if (!mcu->shadow) {
+        mcu->shadow = calloc(DP_ID_COUNT, sizeof(*mcu->shadow));
+        mcu->shadow_sent = calloc(DP_ID_COUNT, sizeof(*mcu->shadow_sent));
+    }
+    if (!mcu->shadow || !mcu->shadow_sent) {
+        free(mcu->shadow);
+        free(mcu->shadow_sent);
+        mcu->shadow = NULL;
+        mcu->shadow_sent = NULL;
+        return -1;
+    }
+
+    mcu->shadow_pool = pool;
+    return 0;
+}
+
+int tuya_mcu_get_dp(tuya_mcu_t mcu, uint8_t id, tuya_dp_t *dp)
+{
+    tuya_dp_view_t view;
+
+    if (!mcu || !dp || !mcu->shadow || !mcu->shadow[id])
+        return -1;
+
+    tuya_dp_ref_view(mcu->shadow[id], &view);
+    return tuya_dp_from_view(dp, &view);
+}
+
+bool tuya_mcu_dp_matches_shadow(tuya_mcu_t mcu, const tuya_dp_t *dp)
+{
+    uint8_t buf[4 + sizeof(dp->data)];
+
+    if (!mcu || !dp || !mcu->shadow || !mcu->shadow[dp->id])
+        return false;
+
+    // A write not echoed yet may still change the value
+    uint32_t bit = 1u << (dp->id % 32);
+    if (mcu->shadow_pending[dp->id / 32] & bit) {
+        if (tuya_mcu_now(mcu) - mcu->shadow_sent[dp->id].at < mcu->dp_write_timeout)
+            return false;
+        mcu->shadow_pending[dp->id / 32] &= ~bit; // Never echoed, the MCU kept the reported value
+    }
+
+    // Compare in wire format, as the MCU would see the write
+    int len = tuya_dp_serialize(dp, buf, sizeof(buf));
+    if (len < 4)
+        return false;
+
+    tuya_dp_ref_t entry = mcu->shadow[dp->id];
+    return entry->type == dp->type && entry->len == len - 4 &&
+           memcmp(tuya_dp_ref_value(entry), buf + 4, entry->len) == 0;
+}
+
+static void tuya_shadow_update(tuya_mcu_t mcu, const tuya_dp_view_t *view)
+{
+    tuya_dp_ref_t entry = tuya_dp_pool_alloc(mcu->shadow_pool, view);
+
+    if (!entry)
+        return; // Pool exhausted or value too large, keep previous value
+
+    tuya_dp_pool_release(mcu->shadow_pool, mcu->shadow[view->id]);
+    mcu->shadow[view->id] = entry;
+
+    uint32_t bit = 1u << (view->id % 32);
+    if ((mcu->shadow_pending[view->id / 32] & bit) && mcu->shadow_sent[view->id].hash == tuya_dp_view_hash(view))
+        mcu->shadow_pending[view->id / 32] &= ~bit;
+}
+
+static void tuya_frame_handle_dps(tuya_mcu_t mcu, const uint8_t *data, size_t len)
+{
+    tuya_dp_iter_t it;
+    tuya_dp_view_t view;
+    size_t         valid = 0;
+
+    tuya_dp_iter_init(&it, data, len);
+    while (tuya_dp_iter_next(&it, &view) > 0) {
+        valid = it.pos - data;
+        if (mcu->shadow)
+            tuya_shadow_update(mcu, &view);
+        if (mcu->dp_writes_used)
+            tuya_dp_write_echo(mcu, &view);
+        if (mcu->dp_handler) {
+            tuya_dp_t dp;
+            if (tuya_dp_from_view(&dp, &view) == 0)
+                mcu->dp_handler(mcu, &dp, mcu->dp_handler_arg);
+        }
+    }
+    // Malformed tail is dropped, batch handler only sees complete DPs
+    if (valid > 0 && mcu->dp_batch_handler)
+        mcu->dp_batch_handler(mcu, data, valid, mcu->dp_batch_handler_arg);
+}
+
+static int tuya_cmd_heartbeat(tuya_mcu_t mcu, uint8_t ver, uint8_t cmd, const uint8_t *data, size_t len,
+                              void *arg)
+{
+    // 0x00 is the first answer after the MCU booted, its state is gone
+    if (len > 0 && data[0] == 0x00 && mcu->state == TUYA_MCU_INITIALIZED)
+        tuya_link_resync(mcu);
+    // Fast start does not wait a period for the next answer
+    else if (len > 0 && (data[0] == 0x01 || mcu->fast_start_initial))
+        mcu->heartbeat_received = true; // Heartbeat received
+    return 0;
+}
+
+static int tuya_cmd_product_info(tuya_mcu_t mcu, uint8_t ver, uint8_t cmd, const uint8_t *data, size_t len,
+                                 void *arg)
+{
+    return parse_product_info(mcu, (const char *)data, len);
+}
+
+static int tuya_cmd_wifi_mode(tuya_mcu_t mcu, uint8_t ver, uint8_t cmd, const uint8_t *data, size_t len,
+                              void *arg)
+{
+    tuya_frame_send_wifi_mode_ack(mcu);
+    if (mcu->config_handler)
+        mcu->config_handler(mcu, mcu->config_handler_arg);
+    return 0;
+}
+
+static int tuya_cmd_state_upload(tuya_mcu_t mcu, uint8_t ver, uint8_t cmd, const uint8_t *data, size_t len,
+                                 void *arg)
+{
+    tuya_frame_handle_dps(mcu, data, len);
+    return 0;
+}
+
+static int tuya_frame_send_sync_result(tuya_mcu_t mcu, bool success)
+{
+    uint8_t result = success ? 0x01 : 0x00;
+    return tuya_frame_send(mcu, MCU_TX_VER, STATE_UPLOAD_SYN_RECV_CMD, &result, 1);
+}
+
+/* Reply has no report id, so results go out strictly in receive order */
+static void tuya_sync_flush(tuya_mcu_t mcu)
+{
+    while (mcu->sync_count) {
+        struct tuya_sync_report *report = &mcu->sync_reports[mcu->sync_head];
+        if (report->state == SYNC_PENDING)
+            break;
+
+        bool success = report->state == SYNC_SUCCEEDED;
+        tuya_frame_send_sync_result(mcu, success);
+        mcu->sync_head = (mcu->sync_head + 1) % SYNC_WINDOW_MAX;
+        mcu->sync_count--;
+        if (mcu->sync_done_cb)
+            mcu->sync_done_cb(mcu, report->id, success, mcu->sync_handler_arg);
+    }
+}
+
+static void tuya_sync_expire(tuya_mcu_t mcu, uint32_t tick)
+{
+    // Reports expire in receive order, only the oldest pending one matters
+    while (mcu->sync_count) {
+        struct tuya_sync_report *report = &mcu->sync_reports[mcu->sync_head];
+        if (report->state == SYNC_PENDING && tick - report->start < mcu->sync_timeout)
+            break;
+        if (report->state == SYNC_PENDING)
+            report->state = SYNC_FAILED;
+        tuya_sync_flush(mcu);
+    }
+}
+
+static int tuya_cmd_state_upload_sync(tuya_mcu_t mcu, uint8_t ver, uint8_t cmd, const uint8_t *data, size_t len,
+                                      void *arg)
+{
+    tuya_frame_handle_dps(mcu, data, len);
+
+    if (!mcu->sync_handler)
+        return tuya_frame_send_sync_result(mcu, true); // Nobody to ask, DPs were delivered
+    if (mcu->sync_count >= mcu->sync_window)
+        return -1; // No reply, MCU retries once the window drains
+
+    struct tuya_sync_report *report = &mcu->sync_reports[(mcu->sync_head + mcu->sync_count) % SYNC_WINDOW_MAX];
+    report->id = mcu->sync_next_id++;
+    report->state = SYNC_PENDING;
+    report->start = tuya_mcu_now(mcu);
+    mcu->sync_count++;
+
+    // Handler may complete the report right away
+    if (mcu->sync_handler(mcu, report->id, data, len, mcu->sync_handler_arg) < 0)
+        tuya_mcu_complete_sync_report(mcu, report->id, false);
+    return 0;
+}
+
+int tuya_mcu_set_sync_report_handler(tuya_mcu_t mcu, tuya_mcu_sync_report_handler_t handler,
+                                     tuya_mcu_sync_done_cb_t done_cb, void *arg)
+{
+    if (!mcu)
+        return -1;
+
+    // Reports in flight keep their place, new ones follow the new handler
+    mcu->sync_handler = handler;
+    mcu->sync_done_cb = done_cb;
+    mcu->sync_handler_arg = arg;
+    return 0;
+}
+
+int tuya_mcu_set_sync_window(tuya_mcu_t mcu, uint8_t window, uint32_t timeout_ms)
+{
+    if (!mcu || window == 0 || window > SYNC_WINDOW_MAX || timeout_ms == 0)
+        return -1;
+
+    mcu->sync_window = window;
+    mcu->sync_timeout = timeout_ms;
+    return 0;
+}
+
+int tuya_mcu_complete_sync_report(tuya_mcu_t mcu, uint16_t id, bool success)
+{
+    if (!mcu)
+        return -1;
+
+    for (uint8_t i = 0; i < mcu->sync_count; i++) {
+        struct tuya_sync_report *report = &mcu->sync_reports[(mcu->sync_head + i) % SYNC_WINDOW_MAX];
+        if (report->id != id || report->state != SYNC_PENDING)
+            continue;
+
+        report->state = success ? SYNC_SUCCEEDED : SYNC_FAILED;
+        tuya_sync_flush(mcu);
+        return 0;
+    }
+    return -1; // Unknown or already timed out
+}
+
+static size_t tuya_stream_hdr_len(uint8_t cmd)
+{
+    return cmd == STREAM_TRANS_CMD ? STREAM_HDR_LEN : MAPS_STREAM_HDR_LEN;
+}
+
+static void tuya_stream_hdr_parse(tuya_mcu_stream_hdr_t *hdr, uint8_t cmd, const uint8_t *data)
+{
+    memset(hdr, 0, sizeof(*hdr));
+    hdr->cmd = cmd;
+    if (cmd == MAPS_STREAM_TRANS_CMD) {
+        hdr->version = data[0];
+        hdr->id = (data[1] << 8) | data[2];
+        hdr->sub_id = data[3];
+        hdr->attr = data[4];
+        data += 5;
+    } else {
+        hdr->id = (data[0] << 8) | data[1];
+        data += 2;
+    }
+    hdr->offset = ((uint32_t)data[0] << 24) | ((uint32_t)data[1] << 16) | ((uint32_t)data[2] << 8) | data[3];
+}
+
+static size_t tuya_stream_hdr_build(const tuya_mcu_stream_hdr_t *hdr, uint32_t offset, uint8_t *out)
+{
+    size_t pos = 0;
+
+    if (hdr->cmd == MAPS_STREAM_TRANS_CMD) {
+        out[pos++] = hdr->version;
+        out[pos++] = hdr->id >> 8;
+        out[pos++] = hdr->id & 0xFF;
+        out[pos++] = hdr->sub_id;
+        out[pos++] = hdr->attr;
+    } else {
+        out[pos++] = hdr->id >> 8;
+        out[pos++] = hdr->id & 0xFF;
+    }
+    out[pos++] = offset >> 24;
+    out[pos++] = (offset >> 16) & 0xFF;
+    out[pos++] = (offset >> 8) & 0xFF;
+    out[pos++] = offset & 0xFF;
+    return pos;
+}
+
+/* Offset 0 starts a stream, any other offset must continue the one in progress */
+static void tuya_stream_begin(tuya_mcu_t mcu, uint8_t cmd, const uint8_t *hdr_data)
+{
+    struct tuya_stream_rx *rx = &mcu->stream;
+
+    tuya_stream_hdr_parse(&rx->hdr, cmd, hdr_data);
+    rx->received = 0;
+    rx->accept = rx->hdr.offset == 0 ||
+                 (rx->hdr.id == rx->id && rx->hdr.sub_id == rx->sub_id && rx->hdr.offset == rx->next);
+}
+
+static void tuya_stream_data(tuya_mcu_t mcu, const uint8_t *data, size_t len)
+{
+    struct tuya_stream_rx *rx = &mcu->stream;
+
+    if (rx->accept && len > 0 &&
+        mcu->stream_sink(mcu, &rx->hdr, rx->hdr.offset + rx->received, data, len, mcu->stream_arg) < 0)
+        rx->accept = false;
+    rx->received += len;
+}
+
+static void tuya_stream_end(tuya_mcu_t mcu, bool ok)
+{
+    struct tuya_stream_rx *rx = &mcu->stream;
+    uint8_t                status;
+
+    ok = ok && rx->accept;
+    if (ok) {
+        rx->id = rx->hdr.id;
+        rx->sub_id = rx->hdr.sub_id;
+        rx->next = rx->hdr.offset + rx->received;
+    }
+    if (mcu->stream_done)
+        mcu->stream_done(mcu, &rx->hdr, ok, mcu->stream_arg);
+
+    status = ok ? STREAM_OK : STREAM_FAILED;
+    tuya_frame_send(mcu, MCU_TX_VER, rx->hdr.cmd, &status, 1);
+}
+
+static int tuya_cmd_stream(tuya_mcu_t mcu, uint8_t ver, uint8_t cmd, const uint8_t *data, size_t len, void *arg)
+{
+    size_t hdr_len = tuya_stream_hdr_len(cmd);
+
+    if (!mcu->stream_sink || len < hdr_len)
+        return -1;
+
+    tuya_stream_begin(mcu, cmd, data);
+    tuya_stream_data(mcu, data + hdr_len, len - hdr_len);
+    tuya_stream_end(mcu, true);
+    return 0;
+}
+
+/* Frame too large for rx_buf: hand its data to the sink as it arrives, checksum is known only at the end */
+static bool tuya_stream_pass_start(tuya_mcu_t mcu, const uint8_t *frame, size_t avail, size_t len)
+{
+    uint8_t cmd = frame[FRAME_TYPE];
+    size_t  hdr_len = tuya_stream_hdr_len(cmd);
+    uint8_t slot = mcu->cmd_slot[cmd];
+
+    if ((cmd != STREAM_TRANS_CMD && cmd != MAPS_STREAM_TRANS_CMD) || !mcu->stream_sink || len < hdr_len ||
+        len > mcu->stream_max || !slot || mcu->cmd_table[slot - 1].handler != tuya_cmd_stream)
+        return false;
+    if (avail < DATA_START + hdr_len)
+        return true; // Wait for the stream header
+
+    // Nothing is checksummed before the data flows, a header out of sequence is most likely noise
+    tuya_stream_begin(mcu, cmd, frame + DATA_START);
+    if (!mcu->stream.accept)
+        return false;
+    mcu->stream.left = len - hdr_len;
+    mcu->stream.len = PROTOCOL_HEAD + len;
+    mcu->stream.sum = get_check_sum(frame, DATA_START + hdr_len);
+    mcu->stream.active = true;
+    mcu->rx_head += DATA_START + hdr_len;
+    return true;
+}
+
+static void tuya_stream_pass(tuya_mcu_t mcu)
+{
+    struct tuya_stream_rx *rx = &mcu->stream;
+    uint8_t               *data = mcu->rx_buf + mcu->rx_head;
+    size_t                 n = mcu->rx_tail - mcu->rx_head;
+
+    if (rx->left > 0) {
+        if (n > rx->left)
+            n = rx->left;
+        rx->sum += get_check_sum(data, n);
+        tuya_stream_data(mcu, data, n);
+        rx->left -= n;
+        mcu->rx_head += n;
+        return;
+    }
+    // Checksum byte closes the frame
+    mcu->rx_head++;
+    rx->active = false;
+    if (data[0] == rx->sum) {
+        tuya_stats_count(mcu->stats.rx, rx->hdr.cmd, rx->len);
+        mcu->rx_seen = true;
+    } else
+        mcu->stats.rx_checksum_errors++;
+    tuya_stream_end(mcu, data[0] == rx->sum);
+}
+
+int tuya_mcu_set_stream_sink(tuya_mcu_t mcu, tuya_mcu_stream_sink_t sink, tuya_mcu_stream_done_t done, void *arg)
+{
+    if (!mcu)
+        return -1;
+
+    mcu->stream_sink = sink;
+    mcu->stream_done = done;
+    mcu->stream_arg = arg;
+    return 0;
+}
+
+int tuya_mcu_set_stream_max_len(tuya_mcu_t mcu, uint16_t max_len)
+{
+    if (!mcu || max_len == 0)
+        return -1;
+
+    mcu->stream_max = max_len;
+    return 0;
+}
+
+int tuya_mcu_send_stream(tuya_mcu_t mcu, const tuya_mcu_stream_hdr_t *hdr, const uint8_t *data, size_t len,
+                         size_t chunk)
+{
+    uint8_t hdr_buf[MAPS_STREAM_HDR_LEN];
+    size_t  hdr_len, n, pos = 0;
+    int     frames = 0;
+
+    if (!mcu || !hdr || (len > 0 && !data) || (hdr->cmd != STREAM_TRANS_CMD && hdr->cmd != MAPS_STREAM_TRANS_CMD))
+        return -1;
+    if (chunk == 0 || chunk > STREAM_FRAME_MAX - MAPS_STREAM_HDR_LEN)
+        chunk = STREAM_FRAME_MAX - MAPS_STREAM_HDR_LEN;
+
+    do {
+        n = len - pos < chunk ? len - pos : chunk;
+        hdr_len = tuya_stream_hdr_build(hdr, hdr->offset + pos, hdr_buf);
+        if (tuya_mcu_send_frame_gather(mcu, hdr->cmd, hdr_buf, hdr_len, data + pos, n) < 0)
+            return -1;
+        pos += n;
+        frames++;
+    } while (pos < len);
+    return frames;
+}
+
+int tuya_mcu_register_cmd_handler(tuya_mcu_t mcu, uint8_t cmd, tuya_mcu_cmd_handler_t handler, void *arg)
+{
+    if (!mcu)
+        return -1;
+
+    uint8_t slot = mcu->cmd_slot[cmd];
+    if (!slot) {
+        if (!handler)
+            return 0; // Nothing to remove
+        if (mcu->cmd_slots_used >= CMD_SLOTS)
+            return -1; // Table full
+        slot = ++mcu->cmd_slots_used;
+    }
+    // Slots are never given back, a removed command keeps its slot for re-registration
+    mcu->cmd_table[slot - 1].handler = handler;
+    mcu->cmd_table[slot - 1].arg = arg;
+    mcu->cmd_slot[cmd] = slot;
+    return 0;
+}
+
+int tuya_mcu_get_cmd_handler(tuya_mcu_t mcu, uint8_t cmd, tuya_mcu_cmd_handler_t *handler, void **arg)
+{
+    if (!mcu || !handler || !arg)
+        return -1;
+
+    uint8_t slot = mcu->cmd_slot[cmd];
+    *handler = slot ? mcu->cmd_table[slot - 1].handler : NULL;
+    *arg = slot ? mcu->cmd_table[slot - 1].arg : NULL;
+    return 0;
+}
+
+int tuya_mcu_send_frame(tuya_mcu_t mcu, uint8_t cmd, const uint8_t *data, size_t len)
+{
+    if (!mcu || (len > 0 && !data))
+        return -1;
+    return tuya_frame_send(mcu, MCU_TX_VER, cmd, data, len);
+}
+
+static int tuya_frame_handle(tuya_mcu_t mcu, uint8_t ver, uint8_t cmd, uint8_t *data, size_t len)
+{
+    uint8_t slot = mcu->cmd_slot[cmd];
+
+    // A checksummed frame is the proof the rate is right and the MCU is alive
+    mcu->baud_answered = true;
+    mcu->rx_seen = true;
+    tuya_stats_count(mcu->stats.rx, cmd, PROTOCOL_HEAD + len);
+    if (!slot || !mcu->cmd_table[slot - 1].handler) {
+        mcu->stats.rx_unhandled++;
+        return -1; // Unhandled command
+    }
+
+    struct tuya_cmd_entry *entry = &mcu->cmd_table[slot - 1];
+    uint32_t               start = tuya_mcu_get_time_us();
+    int                    ret = entry->handler(mcu, ver, cmd, data, len, entry->arg);
+    tuya_mcu_hist_add(mcu->stats.handler_us, tuya_mcu_get_time_us() - start);
+    return ret;
+}
+
+static void tuya_frame_discard(tuya_mcu_t mcu, size_t n)
+{
+    mcu->rx_head += n;
+    mcu->stats.rx_discarded += n;
+}
+
+/* Parse all complete frames in rx_buf in place, without moving data */
+static void tuya_frame_parse(tuya_mcu_t mcu)
+{
+    // TUYA frame: 0x55 0xAA [version] [cmd] [lenH] [lenL] [data...] [checksum]
+    while (mcu->rx_head < mcu->rx_tail) {
+        if (mcu->stream.active) {
+            tuya_stream_pass(mcu);
+            continue;
+        }
+
+        uint8_t *frame = mcu->rx_buf + mcu->rx_head;
+        size_t   avail = mcu->rx_tail - mcu->rx_head;
+
+        if (frame[HEAD_FIRST] != FRAME_FIRST) {
+            // Skip forward to the next possible header
+            uint8_t *next = memchr(frame, FRAME_FIRST, avail);
+            tuya_frame_discard(mcu, next ? (size_t)(next - frame) : avail);
+            continue;
+        }
+        if (avail < 2)
+            break; // Wait for more data
+        if (frame[HEAD_SECOND] != FRAME_SECOND) {
+            tuya_frame_discard(mcu, 1);
+            continue;
+        }
+        if (avail < DATA_START)
+            break; // Wait for more data
+
+        size_t len = (frame[LENGTH_HIGH] << 8) | frame[LENGTH_LOW];
+        size_t frame_len = PROTOCOL_HEAD + len; // header+ver+cmd+lenH+lenL+data+checksum
+        if (frame_len > RX_BUF_SIZE) {
+            if (tuya_stream_pass_start(mcu, frame, avail, len)) {
+                if (!mcu->stream.active)
+                    break; // Wait for the stream header
+                continue;
+            }
+            // Frame can never fit, treat header as noise
+            mcu->stats.rx_oversize++;
+            tuya_frame_discard(mcu, 2);
+            continue;
+        }
+        if (avail < frame_len)
+            break; // Wait for more data
+
+        if (get_check_sum(frame, DATA_START + len) != frame[frame_len - 1]) {
+            // Checksum error, resynchronise on the next header
+            mcu->stats.rx_checksum_errors++;
+            tuya_frame_discard(mcu, 1);
+            continue;
+        }
+        mcu->rx_head += frame_len;
+        tuya_frame_handle(mcu, frame[PROTOCOL_VERSION], frame[FRAME_TYPE], frame + DATA_START, len);
+    }
+
+    if (mcu->rx_head == mcu->rx_tail)
+        mcu->rx_head = mcu->rx_tail = 0;
+}
+
+static int tuya_frame_receive(tuya_mcu_t mcu)
+{
+    size_t room;
+    int    n;
+
+    do {
+        if (mcu->rx_tail == RX_BUF_SIZE) {
+            // Only the tail of one partial frame is left, move it to the front
+            memmove(mcu->rx_buf, mcu->rx_buf + mcu->rx_head, mcu->rx_tail - mcu->rx_head);
+            mcu->rx_tail -= mcu->rx_head;
+            mcu->rx_head = 0;
+        }
+        // Take whatever the driver has buffered, without waiting for more
+        room = RX_BUF_SIZE - mcu->rx_tail;
+        n = tuya_mcu_uart_read(mcu->uart_context, mcu->rx_buf + mcu->rx_tail, room, 0);
+        if (n < 0)
+            return -1;
+
+        if (mcu->capture && n > 0) {
+            tuya_capture_begin(mcu->capture, tuya_mcu_now(mcu), TUYA_CAPTURE_RX, n);
+            tuya_capture_append(mcu->capture, mcu->rx_buf + mcu->rx_tail, n);
+        }
+        mcu->rx_tail += n;
+        tuya_frame_parse(mcu);
+    } while ((size_t)n == room);
+
+    return 0;
+}
+
+__attribute__((weak)) int tuya_mcu_uart_set_baud(void *ctx, uint32_t baud)
+{
+    return -1;
+}
+
+int tuya_mcu_set_baud_handler(tuya_mcu_t mcu, tuya_mcu_baud_handler_t handler, void *arg)
+{
+    if (!mcu)
+        return -1;
+
+    mcu->baud_handler = handler;
+    mcu->baud_handler_arg = arg;
+    return 0;
+}
+
+/* Move the UART to rate, dropping whatever was received at the old one */
+static int tuya_baud_apply(tuya_mcu_t mcu, uint32_t rate, uint32_t timeout, uint32_t tick)
+{
+    if (tuya_mcu_uart_set_baud(mcu->uart_context, rate) != 0)
+        return -1;
+
+    mcu->baud = rate;
+    mcu->rx_head = mcu->rx_tail = 0;
+    mcu->stream.active = false;
+    mcu->baud_answered = false;
+    mcu->baud_start = tick;
+    mcu->baud_timeout = timeout;
+    mcu->baud_last_hb = tick;
+    tuya_frame_send_heartbeat(mcu);
+    return 0;
+}
+
+int tuya_mcu_set_baud_probe(tuya_mcu_t mcu, const uint32_t *rates, size_t count, uint32_t interval_ms)
+{
+    if (!mcu || !rates || count == 0 || count > TUYA_MCU_BAUD_RATES_MAX || mcu->baud_state != BAUD_FIXED)
+        return -1;
+
+    memcpy(mcu->baud_rates, rates, count * sizeof(rates[0]));
+    mcu->baud_count = count;
+    mcu->baud_index = 0;
+    if (tuya_baud_apply(mcu, rates[0], interval_ms ? interval_ms : BAUD_PROBE_INTERVAL, tuya_mcu_now(mcu)) != 0)
+        return -1;
+    if (count > 1) {
+        mcu->baud = 0; // Unknown until the MCU answers
+        mcu->baud_state = BAUD_PROBING;
+    }
+    return 0;
+}
+
+int tuya_mcu_switch_baud(tuya_mcu_t mcu, uint32_t baud, uint32_t timeout_ms)
+{
+    if (!mcu || !baud || !timeout_ms || !mcu->baud || mcu->baud_state != BAUD_FIXED)
+        return -1;
+
+    uint32_t prev = mcu->baud;
+    if (tuya_baud_apply(mcu, baud, timeout_ms, tuya_mcu_now(mcu)) != 0)
+        return -1;
+    mcu->baud_prev = prev;
+    mcu->baud_state = BAUD_SWITCHING;
+    return 0;
+}
+
+uint32_t tuya_mcu_get_baud(tuya_mcu_t mcu)
+{
+    return mcu ? mcu->baud : 0;
+}
+
+static void tuya_baud_tick(tuya_mcu_t mcu, uint32_t tick)
+{
+    uint32_t rate = mcu->baud_state == BAUD_PROBING ? mcu->baud_rates[mcu->baud_index] : mcu->baud;
+
+    if (mcu->baud_answered) {
+        mcu->baud = rate;
+        mcu->baud_state = BAUD_FIXED;
+        if (mcu->baud_handler)
+            mcu->baud_handler(mcu, rate, true, mcu->baud_handler_arg);
+        return;
+    }
+    if (tick - mcu->baud_start < mcu->baud_timeout) {
+        // Give a switch more than one chance, a heartbeat can cross the MCU's own switch
+        if (mcu->baud_state == BAUD_SWITCHING && tick - mcu->baud_last_hb >= BAUD_SWITCH_INTERVAL) {
+            mcu->baud_last_hb = tick;
+            tuya_frame_send_heartbeat(mcu);
+        }
+        return;
+    }
+
+    if (mcu->baud_state == BAUD_PROBING) {
+        mcu->baud_index = (mcu->baud_index + 1) % mcu->baud_count;
+        if (tuya_baud_apply(mcu, mcu->baud_rates[mcu->baud_index], mcu->baud_timeout, tick) == 0)
+            mcu->baud = 0;
+        return;
+    }
+    // MCU did not follow, go back to the rate it was last heard at
+    mcu->baud_state = BAUD_FIXED;
+    if (tuya_baud_apply(mcu, mcu->baud_prev, 0, tick) != 0)
+        mcu->baud = 0;
+    if (mcu->baud_handler)
+        mcu->baud_handler(mcu, rate, false, mcu->baud_handler_arg);
+}
+
+static void tuya_mcu_state_change(tuya_mcu_t mcu, enum tuya_mcu_state new_state)
+{
+    if (mcu->state_handler) {
+        mcu->state_handler(mcu, new_state, mcu->state_handler_arg);
+    }
+    mcu->state = new_state;
+}
+
+/* Start over with the handshake, the MCU may come back with other product information */
+static void tuya_link_resync(tuya_mcu_t mcu)
+{
+    mcu->stats.resyncs++;
+    memset(&mcu->info, 0, sizeof(mcu->info));
+    mcu->heartbeat_received = false;
+    mcu->hb_waiting = false;
+    mcu->hb_missed = 0;
+    mcu->fast_start_wait = 0;
+    tuya_mcu_state_change(mcu, TUYA_MCU_INIT_HEARTBEAT);
+}
+
+/* Heartbeat only when the MCU has been quiet, retry unanswered ones after HEARTBEAT_REPLY_TIMEOUT */
+static void tuya_link_tick(tuya_mcu_t mcu, uint32_t tick)
+{
+    if (mcu->hb_waiting) {
+        if (tick - mcu->last_heartbeat < HEARTBEAT_REPLY_TIMEOUT)
+            return;
+        mcu->stats.heartbeats_missed++;
+        if (++mcu->hb_missed >= mcu->hb_max_missed) {
+            tuya_link_resync(mcu);
+            return;
+        }
+        tuya_frame_send_heartbeat(mcu);
+        return;
+    }
+    // Never more than one per interval, nothing else limits them when answers are not awaited
+    if (tick - mcu->last_heartbeat < mcu->hb_interval)
+        return;
+    if (tick - mcu->last_rx > mcu->hb_interval || tick - mcu->last_heartbeat > mcu->hb_max_interval) {
+        tuya_frame_send_heartbeat(mcu);
+        mcu->hb_waiting = mcu->hb_max_missed > 0;
+    }
+}
+
+/* Move on as soon as answers allow, send what is still missing when the retry interval is up */
+static void tuya_fast_start_tick(tuya_mcu_t mcu, uint32_t tick)
+{
+    bool info_known = mcu->info.product_id[0] && mcu->info.version[0];
+
+    if (mcu->state == TUYA_MCU_INIT_HEARTBEAT && (mcu->heartbeat_received || info_known))
+        tuya_mcu_state_change(mcu, TUYA_MCU_QUERY_INFO);
+    if (mcu->state == TUYA_MCU_QUERY_INFO && info_known) {
+        tuya_mcu_send_state_request(mcu);
+        mcu->last_heartbeat = tick; // Regular heartbeats from here
+        tuya_mcu_state_change(mcu, TUYA_MCU_INITIALIZED);
+        return;
+    }
+    // Probing sends its own heartbeats and nothing else gets through at a wrong rate
+    if (mcu->state == TUYA_MCU_INITIALIZED || mcu->baud_state == BAUD_PROBING)
+        return;
+    if (mcu->fast_start_wait && tick - mcu->fast_start_sent < mcu->fast_start_wait)
+        return;
+
+    if (!mcu->heartbeat_received)
+        tuya_frame_send_heartbeat(mcu);
+    if (!info_known)
+        tuya_frame_query_product_info(mcu);
+    mcu->fast_start_sent = tick;
+    mcu->fast_start_wait = mcu->fast_start_wait ? mcu->fast_start_wait * 2 : mcu->fast_start_initial;
+    if (mcu->fast_start_wait > mcu->fast_start_max)
+        mcu->fast_start_wait = mcu->fast_start_max;
+}
+
+/* Mirrors the checks of tuya_mcu_tick and the expiry functions, a deadline that comes too early costs a tick */
+uint32_t tuya_mcu_next_deadline(tuya_mcu_t mcu)
+{
+    if (!mcu)
+        return UINT32_MAX;
+
+    uint32_t now = tuya_mcu_now(mcu), next = UINT32_MAX;
+    bool     info_known = mcu->info.product_id[0] && mcu->info.version[0];
+
+    if (mcu->baud_state != BAUD_FIXED) {
+        tuya_deadline_min(&next, mcu->baud_answered ? now : mcu->baud_start + mcu->baud_timeout, now);
+        if (mcu->baud_state == BAUD_SWITCHING)
+            tuya_deadline_min(&next, mcu->baud_last_hb + BAUD_SWITCH_INTERVAL, now);
+    }
+
+    switch (mcu->state) {
+    case TUYA_MCU_INIT_HEARTBEAT:
+    case TUYA_MCU_QUERY_INFO:
+        if (mcu->fast_start_initial) {
+            if ((mcu->state == TUYA_MCU_INIT_HEARTBEAT && mcu->heartbeat_received) || info_known)
+                next = 0;
+            else if (mcu->baud_state != BAUD_PROBING)
+                tuya_deadline_min(&next, mcu->fast_start_wait ? mcu->fast_start_sent + mcu->fast_start_wait : now, now);
+        } else if (mcu->state == TUYA_MCU_INIT_HEARTBEAT) {
+            if (mcu->heartbeat_received)
+                next = 0;
+            else if (mcu->baud_state != BAUD_PROBING)
+                tuya_deadline_min(&next, mcu->last_heartbeat + HANDSHAKE_HEARTBEAT_PERIOD + 1, now);
+        } else {
+            tuya_deadline_min(&next, info_known ? now : mcu->last_query + HANDSHAKE_QUERY_PERIOD + 1, now);
+        }
+        break;
+    case TUYA_MCU_INITIALIZED:
+        if (mcu->hb_waiting) {
+            tuya_deadline_min(&next, mcu->last_heartbeat + HEARTBEAT_REPLY_TIMEOUT, now);
+        } else {
+            uint32_t due = mcu->last_rx + mcu->hb_interval + 1;
+            if ((int32_t)(mcu->last_heartbeat + mcu->hb_max_interval + 1 - due) < 0)
+                due = mcu->last_heartbeat + mcu->hb_max_interval + 1;
+            if ((int32_t)(mcu->last_heartbeat + mcu->hb_interval - due) > 0)
+                due = mcu->last_heartbeat + mcu->hb_interval; // Same limit as tuya_link_tick
+            tuya_deadline_min(&next, due, now);
+        }
+        break;
+    default:
+        break;
+    }
+
+    if (mcu->sync_count) {
+        const struct tuya_sync_report *report = &mcu->sync_reports[mcu->sync_head];
+        tuya_deadline_min(&next, report->state == SYNC_PENDING ? report->start + mcu->sync_timeout : now, now);
+    }
+    for (int i = 0; i < DP_WRITE_SLOTS && mcu->dp_writes_used; i++) {
+        if (mcu->dp_writes[i].cb)
+            tuya_deadline_min(&next, mcu->dp_writes[i].sent + mcu->dp_write_timeout, now);
+    }
+    return next;
+}
+
+int tuya_mcu_tick(tuya_mcu_t mcu)
+{
+    if (!mcu)
+        return -1;
+
+    uint32_t tick = tuya_mcu_now(mcu);
+
+    if (mcu->baud_state != BAUD_FIXED)
+        tuya_baud_tick(mcu, tick);
+
+    switch (mcu->state) {
+    case TUYA_MCU_INIT_HEARTBEAT:
+        if (mcu->fast_start_initial) {
+            tuya_fast_start_tick(mcu, tick);
+            break;
+        }
+        /* should send heartbeat frames every second, probing sends its own */
+        if (mcu->baud_state != BAUD_PROBING && tick - mcu->last_heartbeat > HANDSHAKE_HEARTBEAT_PERIOD)
+            tuya_frame_send_heartbeat(mcu);
+
+        if (mcu->heartbeat_received)
+            tuya_mcu_state_change(mcu, TUYA_MCU_QUERY_INFO);
+
+        break;
+    case TUYA_MCU_QUERY_INFO:
+        if (mcu->fast_start_initial) {
+            tuya_fast_start_tick(mcu, tick);
+            break;
+        }
+        /* should send product info query every 5 seconds */
+        if (tick - mcu->last_query > HANDSHAKE_QUERY_PERIOD)
+            tuya_frame_query_product_info(mcu);
+
+        // Check if we have received product info
+        if (mcu->info.product_id[0] && mcu->info.version[0]) {
+            tuya_mcu_send_state_request(mcu);
+            tuya_mcu_state_change(mcu, TUYA_MCU_INITIALIZED);
+        }
+        break;
+
+    case TUYA_MCU_INITIALIZED:
+        tuya_link_tick(mcu, tick);
+        break;
+    default:
+        break;
+    }
+
+    // Receive data from UART
+    if (tuya_frame_receive(mcu) < 0) {
+        return -1;
+    }
+
+    tick = tuya_mcu_now(mcu);
+    if (mcu->rx_seen) {
+        mcu->rx_seen = false;
+        mcu->last_rx = tick;
+        mcu->hb_waiting = false;
+        mcu->hb_missed = 0;
+    }
+    // Answers just received may already complete the handshake
+    if (mcu->fast_start_initial && mcu->state != TUYA_MCU_INITIALIZED)
+        tuya_fast_start_tick(mcu, tick);
+    tuya_sync_expire(mcu, tick);
+    tuya_dp_write_expire(mcu, tick);
     return 0;
 }
@@ -6,29 +6,200 @@
 
 #include "tuya-defs.h"
 #include "tuya-dp.h"
+#include "tuya-dp-pool.h"
+#include "tuya-capture.h"
 
 typedef struct tuya_mcu *tuya_mcu_t;
 
+#define TUYA_MCU_PID_LEN 16 // Product ID length
+#define TUYA_MCU_VER_LEN 5  // Version length
+#define TUYA_MCU_IR_LEN  7  // Infrared pins, "tx.rx"
+
+#define TUYA_MCU_BAUD_RATES_MAX 8 // Max rates tried by baud probing
+
+#define TUYA_MCU_FAST_START_INITIAL 50   // Default ms before the first fast start retry
+#define TUYA_MCU_FAST_START_MAX     2000 // Default fast start retry interval limit
+
+#define TUYA_MCU_HEARTBEAT_INTERVAL   15000 // Default ms of silence before a heartbeat once initialized
+#define TUYA_MCU_HEARTBEAT_MAX_MISSED 3     // Default unanswered heartbeats before the handshake restarts
+
+#define TUYA_MCU_STREAM_MAX_LEN 4096 // Default largest stream frame data length passed through the rx buffer
+
+#define TUYA_MCU_STATS_CMDS   0x36 // Commands counted one by one, higher ones share the last entry
+#define TUYA_MCU_HIST_BUCKETS 20   // Histogram buckets: [0] is 0, [i] is 2^(i-1) to 2^i - 1, last is open-ended
+
+// Fields present in tuya_mcu_product_info_t
+#define TUYA_MCU_INFO_PID (1 << 0)
+#define TUYA_MCU_INFO_VER (1 << 1)
+#define TUYA_MCU_INFO_M   (1 << 2)
+#define TUYA_MCU_INFO_MT  (1 << 3)
+#define TUYA_MCU_INFO_N   (1 << 4)
+#define TUYA_MCU_INFO_IR  (1 << 5)
+#define TUYA_MCU_INFO_LOW (1 << 6)
+
+/* Product information reported by the MCU, only fields flagged in present are valid */
+typedef struct {
+    char     product_id[TUYA_MCU_PID_LEN + 1]; // "p": product ID
+    char     version[TUYA_MCU_VER_LEN + 1];    // "v": MCU version
+    char     ir[TUYA_MCU_IR_LEN + 1];          // "ir": infrared tx.rx pins
+    uint16_t mt;                               // "mt": network configuration timeout
+    uint8_t  m;                                // "m": network configuration mode
+    uint8_t  n;                                // "n": multi network configuration
+    bool     low;                              // "low": low power device
+    uint8_t  present;                          // TUYA_MCU_INFO_* of fields sent
+} tuya_mcu_product_info_t;
+
 enum tuya_mcu_state {
     TUYA_MCU_INIT_HEARTBEAT = 0x00,
     TUYA_MCU_QUERY_INFO = 0x01,
     TUYA_MCU_INITIALIZED = 0x02,
 };
 
+enum tuya_mcu_dp_write_status {
+    TUYA_MCU_DP_WRITE_ACKED = 0, // MCU reported the DP back
+    TUYA_MCU_DP_WRITE_TIMEOUT,   // No report within the write timeout
+    TUYA_MCU_DP_WRITE_FAILED,    // Not sent or not tracked
+};
+
+typedef struct {
+    uint8_t                       id;     // DP id
+    enum tuya_mcu_dp_write_status status; // Outcome
+    uint32_t                      rtt_ms; // Time from send to report or timeout
+} tuya_mcu_dp_write_result_t;
+
+/* Header of a STREAM_TRANS_CMD or MAPS_STREAM_TRANS_CMD frame */
+typedef struct {
+    uint8_t  cmd;     // STREAM_TRANS_CMD or MAPS_STREAM_TRANS_CMD
+    uint8_t  version; // Map protocol version, MAPS_STREAM_TRANS_CMD only
+    uint16_t id;      // Stream service id or map id
+    uint8_t  sub_id;  // Sub-map id, MAPS_STREAM_TRANS_CMD only
+    uint8_t  attr;    // Sub-map data attribute, MAPS_STREAM_TRANS_CMD only
+    uint32_t offset;  // Stream offset of the frame's first data byte
+} tuya_mcu_stream_hdr_t;
+
+typedef struct {
+    uint32_t frames; // Frames with a valid checksum
+    uint32_t bytes;  // Bytes of those frames, header and checksum included
+} tuya_mcu_cmd_stats_t;
+
+/* Protocol counters, cheap enough to be always on */
+typedef struct {
+    tuya_mcu_cmd_stats_t rx[TUYA_MCU_STATS_CMDS + 1];       // Received frames by command
+    tuya_mcu_cmd_stats_t tx[TUYA_MCU_STATS_CMDS + 1];       // Sent frames by command
+    uint32_t             rx_checksum_errors;                // Frames dropped for a bad checksum
+    uint32_t             rx_discarded;                      // Bytes dropped while looking for a valid frame
+    uint32_t             rx_oversize;                       // Frames that can never fit the rx buffer
+    uint32_t             rx_unhandled;                      // Frames of a command without handler
+    uint32_t             tx_errors;                         // Frames the UART did not take
+    uint32_t             heartbeats_missed;                 // Heartbeats left unanswered once initialized
+    uint32_t             resyncs;                           // Handshake restarts: link lost or MCU rebooted
+    uint32_t             handler_us[TUYA_MCU_HIST_BUCKETS]; // Command handler run time histogram
+} tuya_mcu_stats_t;
+
 typedef int (*tuya_mcu_state_handler_t)(tuya_mcu_t mcu, enum tuya_mcu_state st, void *arg);
 typedef int (*tuya_mcu_config_handler_t)(tuya_mcu_t mcu, void *arg);
 typedef int (*tuya_mcu_dp_handler_t)(tuya_mcu_t mcu, tuya_dp_t *dp, void *arg);
+/* Called once per frame with all valid DPs, walk them with tuya_dp_iter_init/tuya_dp_iter_next */
+typedef int (*tuya_mcu_dp_batch_handler_t)(tuya_mcu_t mcu, const uint8_t *dps, size_t len, void *arg);
+/* Called for every synchronous status upload, complete it with tuya_mcu_complete_sync_report; <0 fails it */
+typedef int (*tuya_mcu_sync_report_handler_t)(tuya_mcu_t mcu, uint16_t id, const uint8_t *dps, size_t len, void *arg);
+/* Called once the result of a synchronous status upload is sent to the MCU */
+typedef void (*tuya_mcu_sync_done_cb_t)(tuya_mcu_t mcu, uint16_t id, bool success, void *arg);
+typedef void (*tuya_mcu_dp_write_cb_t)(tuya_mcu_t mcu, const tuya_mcu_dp_write_result_t *result, void *arg);
+/* Stream data straight from the rx buffer; a frame may arrive in several chunks, <0 rejects the frame */
+typedef int (*tuya_mcu_stream_sink_t)(tuya_mcu_t mcu, const tuya_mcu_stream_hdr_t *hdr, uint32_t offset,
+                                      const uint8_t *data, size_t len, void *arg);
+/* End of a stream frame; chunks of a frame that is not ok must be dropped */
+typedef void (*tuya_mcu_stream_done_t)(tuya_mcu_t mcu, const tuya_mcu_stream_hdr_t *hdr, bool ok, void *arg);
+/* Baud rate locked by probing, or switch confirmed (ok) or reverted (!ok) */
+typedef void (*tuya_mcu_baud_handler_t)(tuya_mcu_t mcu, uint32_t baud, bool ok, void *arg);
+/* Millisecond clock of one instance, wraps like tuya_mcu_get_tick */
+typedef uint32_t (*tuya_mcu_clock_t)(void *arg);
+/* Called from the receive path with the payload still in the rx buffer, valid until return */
+typedef int (*tuya_mcu_cmd_handler_t)(tuya_mcu_t mcu, uint8_t ver, uint8_t cmd, const uint8_t *data, size_t len,
+                                      void *arg);
 
 int tuya_mcu_init(tuya_mcu_t *mcu, void *uart_ctx);
 int tuya_mcu_deinit(tuya_mcu_t mcu);
 
 char *tuya_mcu_get_product_id(tuya_mcu_t mcu);
 char *tuya_mcu_get_version(tuya_mcu_t mcu);
+const tuya_mcu_product_info_t *tuya_mcu_get_product_info(tuya_mcu_t mcu);
+uint32_t tuya_mcu_get_rx_discarded(tuya_mcu_t mcu);
+const tuya_mcu_stats_t *tuya_mcu_get_stats(tuya_mcu_t mcu);
+void tuya_mcu_reset_stats(tuya_mcu_t mcu);
+/* Frame capture: raw rx bytes and tx frames with ticks, kept in a ring of size bytes, oldest dropped first */
+int  tuya_mcu_enable_capture(tuya_mcu_t mcu, size_t size);
+void tuya_mcu_disable_capture(tuya_mcu_t mcu);
+int  tuya_mcu_dump_capture(tuya_mcu_t mcu, tuya_capture_write_t write, void *arg);
+/* Time source for timers of this instance and its transfers; NULL goes back to tuya_mcu_get_tick */
+int      tuya_mcu_set_clock(tuya_mcu_t mcu, tuya_mcu_clock_t clock, void *arg);
+uint32_t tuya_mcu_now(tuya_mcu_t mcu);
+/* Count value in the power of two bucket of a TUYA_MCU_HIST_BUCKETS histogram */
+void tuya_mcu_hist_add(uint32_t *hist, uint32_t value);
 
 int tuya_mcu_set_state_handler(tuya_mcu_t mcu, tuya_mcu_state_handler_t handler, void *arg);
+/*
+ * Link monitor once initialized: a heartbeat goes out after interval_ms without a valid frame from the MCU, and at
+ * least every max_interval_ms, never more than one per interval_ms. max_missed unanswered heartbeats in a row (0
+ * never) or a heartbeat answer of 0x00, which the MCU sends after it rebooted, restart the handshake.
+ */
+int tuya_mcu_set_heartbeat(tuya_mcu_t mcu, uint32_t interval_ms, uint32_t max_interval_ms, uint8_t max_missed);
+/* Fast start: heartbeat and product query sent together, retried from initial_ms doubling up to max_ms; 0 is off */
+int tuya_mcu_set_fast_start(tuya_mcu_t mcu, uint32_t initial_ms, uint32_t max_ms);
 int tuya_mcu_set_config_handler(tuya_mcu_t mcu, tuya_mcu_config_handler_t handler, void *arg);
 int tuya_mcu_set_dp_handler(tuya_mcu_t mcu, tuya_mcu_dp_handler_t handler, void *arg);
+int tuya_mcu_set_dp_batch_handler(tuya_mcu_t mcu, tuya_mcu_dp_batch_handler_t handler, void *arg);
+/* Handle a command, replacing any built-in handler; NULL handler drops the command */
+int tuya_mcu_register_cmd_handler(tuya_mcu_t mcu, uint8_t cmd, tuya_mcu_cmd_handler_t handler, void *arg);
+/* Handler registered for a command, NULL if none */
+int tuya_mcu_get_cmd_handler(tuya_mcu_t mcu, uint8_t cmd, tuya_mcu_cmd_handler_t *handler, void **arg);
+
+/* DP shadow: last value reported by the MCU for every DP id. The shadow keeps one record of the pool per reported
+   id and needs one more to replace a value, when the pool runs dry the previous value is kept */
+int  tuya_mcu_enable_shadow(tuya_mcu_t mcu, tuya_dp_pool_t pool);
+int  tuya_mcu_get_dp(tuya_mcu_t mcu, uint8_t id, tuya_dp_t *dp);
+/* False while a write sent to the id is not echoed yet, up to the DP write timeout */
+bool tuya_mcu_dp_matches_shadow(tuya_mcu_t mcu, const tuya_dp_t *dp);
+
+/* Synchronous status upload: without a handler reports are acknowledged as soon as their DPs are delivered */
+int tuya_mcu_set_sync_report_handler(tuya_mcu_t mcu, tuya_mcu_sync_report_handler_t handler,
+                                     tuya_mcu_sync_done_cb_t done_cb, void *arg);
+int tuya_mcu_set_sync_window(tuya_mcu_t mcu, uint8_t window, uint32_t timeout_ms);
+int tuya_mcu_complete_sync_report(tuya_mcu_t mcu, uint16_t id, bool success);
+
+/* Stream frames: received in place, larger than the rx buffer ones pass through it in chunks */
+int tuya_mcu_set_stream_sink(tuya_mcu_t mcu, tuya_mcu_stream_sink_t sink, tuya_mcu_stream_done_t done, void *arg);
+/* Longer frames, or ones not starting or continuing a stream, are taken for noise and never reach the sink */
+int tuya_mcu_set_stream_max_len(tuya_mcu_t mcu, uint16_t max_len);
+/* Send data as stream frames of up to chunk bytes starting at hdr->offset, returns number of frames sent */
+int tuya_mcu_send_stream(tuya_mcu_t mcu, const tuya_mcu_stream_hdr_t *hdr, const uint8_t *data, size_t len,
+                         size_t chunk);
+
+/* Baud rate: needs tuya_mcu_uart_set_baud, get returns 0 until a rate is locked */
+int      tuya_mcu_set_baud_handler(tuya_mcu_t mcu, tuya_mcu_baud_handler_t handler, void *arg);
+/* Try rates in turn with heartbeats, interval_ms apart, until the MCU answers; one rate just sets it */
+int      tuya_mcu_set_baud_probe(tuya_mcu_t mcu, const uint32_t *rates, size_t count, uint32_t interval_ms);
+/* Move to baud the MCU agreed to, back to the old rate unless it answers a heartbeat within timeout_ms */
+int      tuya_mcu_switch_baud(tuya_mcu_t mcu, uint32_t baud, uint32_t timeout_ms);
+uint32_t tuya_mcu_get_baud(tuya_mcu_t mcu);
 
 int tuya_mcu_send_wifi_status(tuya_mcu_t mcu, uint8_t state);
+int tuya_mcu_send_frame(tuya_mcu_t mcu, uint8_t cmd, const uint8_t *data, size_t len);
+/* Payload is hdr followed by data, data is written without copying and may exceed the tx buffer */
+int tuya_mcu_send_frame_gather(tuya_mcu_t mcu, uint8_t cmd, const uint8_t *hdr, size_t hdr_len, const uint8_t *data,
+                               size_t len);
 int tuya_mcu_send_dp(tuya_mcu_t mcu, tuya_dp_t *dp);
+/* Pack DPs into as few DATA_QUERT_CMD frames as fit, returns number of frames sent, -1 if any DP was not sent */
+int tuya_mcu_send_dps(tuya_mcu_t mcu, const tuya_dp_t *dps, size_t count);
+/* Same, sent (may be NULL) tells for every view whether it went out */
+int tuya_mcu_send_dp_views(tuya_mcu_t mcu, const tuya_dp_view_t *views, size_t count, bool *sent);
+/*
+ * Wait for the MCU to report the written value back, cb runs once with the outcome. A report of the id with
+ * another value does not complete the write, an MCU that changes what it was given lets it time out.
+ */
+int tuya_mcu_track_dp_write(tuya_mcu_t mcu, const tuya_dp_view_t *view, tuya_mcu_dp_write_cb_t cb, void *arg);
+int tuya_mcu_set_dp_write_timeout(tuya_mcu_t mcu, uint32_t timeout_ms);
 int tuya_mcu_tick(tuya_mcu_t mcu);
+/* ms until tuya_mcu_tick has timed work to do (0 now, UINT32_MAX never); received bytes need a tick anyway */
+uint32_t tuya_mcu_next_deadline(tuya_mcu_t mcu);
@@ -0,0 +1,452 @@
+#include "tuya-xfer.h"
+#include "platform.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define XFER_SLOTS (TUYA_XFER_WINDOW_MAX + 1) // Packets in flight plus the one read ahead
+
+/* Commands and payload layout of one kind of transfer */
+struct tuya_xfer_proto {
+    uint8_t start_cmd;
+    uint8_t trans_cmd;
+    size_t (*build_start)(struct tuya_xfer *xfer, uint8_t *buf, size_t len);
+    size_t (*build_hdr)(struct tuya_xfer *xfer, uint32_t offset, uint8_t *buf);
+    int (*parse_ack)(struct tuya_xfer *xfer, const uint8_t *data, size_t len); // <0 if packet was refused, may be NULL
+};
+
+struct tuya_xfer_packet {
+    uint8_t *data;   // Slot buffer, packet_size bytes
+    uint32_t offset; // Image offset, size for the closing empty packet
+    uint16_t len;    // Data bytes, 0 closes the transfer
+    uint8_t  resent; // Sends beyond the first, each one may still get an ack
+};
+
+struct tuya_xfer {
+    tuya_mcu_t                    mcu;
+    const struct tuya_xfer_proto *proto;
+    tuya_xfer_config_t            config;
+    tuya_xfer_status_t            status;
+
+    uint8_t                *buf;                // Slot buffers
+    struct tuya_xfer_packet packets[XFER_SLOTS]; // Ring: packets in flight, then packets read ahead
+    uint8_t                 slots;               // Slots in use, window + 1
+    uint8_t                 head;                // Oldest packet in flight
+    uint8_t                 in_flight;           // Packets sent and not acked
+    uint8_t                 ready;               // Packets read and not sent
+    uint16_t                surplus;             // Acks still due for resends of packets already acked
+    uint32_t                hold;                // ms to wait for them once nothing else is in flight
+    uint32_t                next_read;           // Image offset of the next packet to read
+    bool                    end_read;            // Closing packet is in the ring
+    uint32_t                sent_at;             // When the oldest packet in flight was sent
+    uint32_t                started;             // When the MCU accepted the transfer
+    uint8_t                 tries;               // Resends of the oldest packet or of the start
+    uint8_t                 resumes;             // Restarts left
+    uint32_t                base;                // Acked bytes when the MCU accepted the transfer
+
+    char     name[TUYA_XFER_NAME_LEN + 1]; // File name, file download only
+    uint16_t file_id;                      // File id, file download only
+    uint8_t  file_type;                    // File type, file download only
+
+    tuya_mcu_cmd_handler_t prev_start;     // Handlers the commands had before the transfer, restored on destroy
+    void                  *prev_start_arg;
+    tuya_mcu_cmd_handler_t prev_trans;
+    void                  *prev_trans_arg;
+};
+
+static void tuya_xfer_finish(struct tuya_xfer *xfer, enum tuya_xfer_state state)
+{
+    xfer->status.state = state;
+    if (xfer->config.progress)
+        xfer->config.progress(xfer, &xfer->status, xfer->config.progress_arg);
+}
+
+static int tuya_xfer_send_start(struct tuya_xfer *xfer)
+{
+    uint8_t buf[96];
+    size_t  len = xfer->proto->build_start(xfer, buf, sizeof(buf));
+
+    xfer->sent_at = tuya_mcu_now(xfer->mcu);
+    return tuya_mcu_send_frame(xfer->mcu, xfer->proto->start_cmd, buf, len);
+}
+
+static int tuya_xfer_send_packet(struct tuya_xfer *xfer, const struct tuya_xfer_packet *packet)
+{
+    uint8_t hdr[16];
+    size_t  hdr_len = xfer->proto->build_hdr(xfer, packet->offset, hdr);
+
+    return tuya_mcu_send_frame_gather(xfer->mcu, xfer->proto->trans_cmd, hdr, hdr_len, packet->data, packet->len);
+}
+
+/* Read ahead into every free slot, runs while the MCU works on the packets in flight */
+static int tuya_xfer_fill(struct tuya_xfer *xfer)
+{
+    while (!xfer->end_read && xfer->in_flight + xfer->ready < xfer->slots) {
+        struct tuya_xfer_packet *packet =
+            &xfer->packets[(xfer->head + xfer->in_flight + xfer->ready) % xfer->slots];
+        uint32_t left = xfer->status.size - xfer->next_read;
+
+        packet->offset = xfer->next_read;
+        packet->len = left < xfer->status.packet_size ? left : xfer->status.packet_size;
+        if (packet->len > 0 &&
+            xfer->config.read(xfer->config.read_arg, packet->offset, packet->data, packet->len) != packet->len)
+            return -1;
+
+        xfer->next_read += packet->len;
+        xfer->end_read = packet->len == 0;
+        xfer->ready++;
+    }
+    return 0;
+}
+
+static int tuya_xfer_send(struct tuya_xfer *xfer)
+{
+    while (xfer->ready && xfer->in_flight < xfer->config.window) {
+        struct tuya_xfer_packet *packet = &xfer->packets[(xfer->head + xfer->in_flight) % xfer->slots];
+        if (tuya_xfer_send_packet(xfer, packet) < 0)
+            return -1;
+        packet->resent = 0;
+        if (xfer->in_flight++ == 0) {
+            xfer->sent_at = tuya_mcu_now(xfer->mcu);
+            xfer->tries = 0;
+        }
+        xfer->ready--;
+    }
+    return 0;
+}
+
+/* Send what was read ahead first, then read the next packet while it is on the wire */
+static int tuya_xfer_advance(struct tuya_xfer *xfer)
+{
+    // Acks for resends still due, one for a packet sent now could not be told from them
+    if (xfer->surplus)
+        return tuya_xfer_fill(xfer);
+    return tuya_xfer_send(xfer) < 0 || tuya_xfer_fill(xfer) < 0 || tuya_xfer_send(xfer) < 0 ? -1 : 0;
+}
+
+static int tuya_xfer_on_start(tuya_mcu_t mcu, uint8_t ver, uint8_t cmd, const uint8_t *data, size_t len, void *arg)
+{
+    struct tuya_xfer *xfer = (struct tuya_xfer *)arg;
+
+    if (xfer->status.state != TUYA_XFER_STARTING)
+        return 0;
+
+    // No payload is the original protocol, fixed 256 byte packets
+    uint8_t code = len > 0 ? data[0] : 0;
+    if (code > 2) {
+        tuya_xfer_finish(xfer, TUYA_XFER_FAILED);
+        return -1;
+    }
+    xfer->status.packet_size = 256 << code;
+    free(xfer->buf); // Packet size may change when a transfer resumes
+    xfer->buf = malloc((size_t)xfer->slots * xfer->status.packet_size);
+    if (!xfer->buf) {
+        tuya_xfer_finish(xfer, TUYA_XFER_FAILED);
+        return -1;
+    }
+    for (uint8_t i = 0; i < xfer->slots; i++)
+        xfer->packets[i].data = xfer->buf + i * xfer->status.packet_size;
+
+    xfer->status.state = TUYA_XFER_SENDING;
+    xfer->started = tuya_mcu_now(xfer->mcu);
+    xfer->base = xfer->status.acked;
+    if (tuya_xfer_fill(xfer) < 0 || tuya_xfer_send(xfer) < 0) {
+        tuya_xfer_finish(xfer, TUYA_XFER_FAILED);
+        return -1;
+    }
+    return 0;
+}
+
+/*
+ * Acks carry no offset, each one completes the oldest packet in flight. A packet sent again before its ack came
+ * in gets one ack per send, the ones beyond the first are dropped and nothing new is sent until they are in, so
+ * later packets are not taken as acked. Resends the MCU never got leave acks that never come, those are given
+ * up after the hold time.
+ */
+static int tuya_xfer_on_ack(tuya_mcu_t mcu, uint8_t ver, uint8_t cmd, const uint8_t *data, size_t len, void *arg)
+{
+    struct tuya_xfer        *xfer = (struct tuya_xfer *)arg;
+    struct tuya_xfer_packet *packet = &xfer->packets[xfer->head];
+    uint32_t                 tick = tuya_mcu_now(xfer->mcu);
+
+    if (xfer->status.state != TUYA_XFER_SENDING)
+        return 0;
+    if (xfer->surplus) {
+        if (--xfer->surplus || xfer->in_flight)
+            return 0;
+        xfer->sent_at = tick;
+        if (tuya_xfer_advance(xfer) < 0) {
+            tuya_xfer_finish(xfer, TUYA_XFER_FAILED);
+            return -1;
+        }
+        return 0;
+    }
+    if (!xfer->in_flight)
+        return 0;
+    if (xfer->proto->parse_ack && xfer->proto->parse_ack(xfer, data, len) < 0) {
+        // Refused, let the timeout path send it again right away
+        xfer->sent_at = tick - xfer->config.timeout_ms;
+        int ret = tuya_xfer_tick(xfer);
+        if (xfer->status.state == TUYA_XFER_SENDING && packet->resent)
+            packet->resent--; // This answer was for one of its sends
+        return ret;
+    }
+
+    xfer->head = (xfer->head + 1) % xfer->slots;
+    xfer->in_flight--;
+    xfer->surplus += packet->resent;
+    if (packet->resent)
+        xfer->hold = (packet->resent + 1) * xfer->config.timeout_ms; // Resends went out timeout_ms apart
+    xfer->sent_at = tick;
+    xfer->tries = 0;
+    if (packet->len == 0) {
+        tuya_xfer_finish(xfer, TUYA_XFER_DONE);
+        return 0;
+    }
+
+    xfer->status.acked += packet->len;
+    uint32_t elapsed = tick - xfer->started;
+    xfer->status.bytes_per_sec = (uint64_t)(xfer->status.acked - xfer->base) * 1000 / (elapsed ? elapsed : 1);
+
+    if (tuya_xfer_advance(xfer) < 0) {
+        tuya_xfer_finish(xfer, TUYA_XFER_FAILED);
+        return -1;
+    }
+    if (xfer->config.progress)
+        xfer->config.progress(xfer, &xfer->status, xfer->config.progress_arg);
+    return 0;
+}
+
+static struct tuya_xfer *tuya_xfer_create(tuya_mcu_t mcu, const struct tuya_xfer_proto *proto,
+                                          const tuya_xfer_config_t *config)
+{
+    struct tuya_xfer *xfer;
+
+    if (!mcu || !config || !config->read || config->window == 0 || config->window > TUYA_XFER_WINDOW_MAX ||
+        config->timeout_ms == 0 || config->offset > config->size)
+        return NULL;
+
+    xfer = calloc(1, sizeof(struct tuya_xfer));
+    if (!xfer)
+        return NULL;
+
+    xfer->mcu = mcu;
+    xfer->proto = proto;
+    xfer->config = *config;
+    xfer->slots = config->window + 1;
+    xfer->status.state = TUYA_XFER_STARTING;
+    xfer->status.size = config->size;
+    xfer->status.acked = config->offset;
+    xfer->next_read = config->offset;
+    xfer->resumes = config->resumes;
+    return xfer;
+}
+
+static tuya_xfer_t tuya_xfer_begin(struct tuya_xfer *xfer)
+{
+    tuya_mcu_t                    mcu = xfer->mcu;
+    const struct tuya_xfer_proto *proto = xfer->proto;
+
+    tuya_mcu_get_cmd_handler(mcu, proto->start_cmd, &xfer->prev_start, &xfer->prev_start_arg);
+    tuya_mcu_get_cmd_handler(mcu, proto->trans_cmd, &xfer->prev_trans, &xfer->prev_trans_arg);
+    if (tuya_mcu_register_cmd_handler(mcu, proto->start_cmd, tuya_xfer_on_start, xfer) != 0 ||
+        tuya_mcu_register_cmd_handler(mcu, proto->trans_cmd, tuya_xfer_on_ack, xfer) != 0 ||
+        tuya_xfer_send_start(xfer) < 0) {
+        tuya_xfer_destroy(xfer);
+        return NULL;
+    }
+    return xfer;
+}
+
+/* MCU keeps what it acked, a new start followed by the remaining packets continues the transfer */
+static int tuya_xfer_restart(struct tuya_xfer *xfer)
+{
+    xfer->status.state = TUYA_XFER_STARTING;
+    xfer->head = 0;
+    xfer->in_flight = 0;
+    xfer->ready = 0;
+    xfer->surplus = 0;
+    xfer->next_read = xfer->status.acked;
+    xfer->end_read = false;
+    xfer->tries = 0;
+    return tuya_xfer_send_start(xfer);
+}
+
+int tuya_xfer_resume(tuya_xfer_t xfer)
+{
+    if (!xfer || xfer->status.state != TUYA_XFER_FAILED)
+        return -1;
+
+    xfer->status.resumes++;
+    return tuya_xfer_restart(xfer);
+}
+
+uint32_t tuya_xfer_next_deadline(tuya_xfer_t xfer)
+{
+    if (!xfer || tuya_xfer_finished(xfer) ||
+        (xfer->status.state == TUYA_XFER_SENDING && !xfer->in_flight && !xfer->surplus))
+        return UINT32_MAX;
+
+    uint32_t waited = tuya_mcu_now(xfer->mcu) - xfer->sent_at;
+    uint32_t timeout = xfer->in_flight || xfer->status.state != TUYA_XFER_SENDING ? xfer->config.timeout_ms : xfer->hold;
+    return waited < timeout ? timeout - waited : 0;
+}
+
+int tuya_xfer_tick(tuya_xfer_t xfer)
+{
+    if (!xfer)
+        return -1;
+
+    uint32_t tick = tuya_mcu_now(xfer->mcu);
+    if (tuya_xfer_finished(xfer))
+        return 0;
+    if (xfer->status.state == TUYA_XFER_SENDING && !xfer->in_flight) {
+        if (!xfer->surplus || tick - xfer->sent_at < xfer->hold)
+            return 0;
+        // The resends never made it, their acks will not come
+        xfer->surplus = 0;
+        xfer->sent_at = tick;
+        if (tuya_xfer_advance(xfer) < 0) {
+            tuya_xfer_finish(xfer, TUYA_XFER_FAILED);
+            return -1;
+        }
+        return 0;
+    }
+    if (tick - xfer->sent_at < xfer->config.timeout_ms)
+        return 0;
+
+    if (xfer->tries++ >= xfer->config.retries) {
+        if (xfer->resumes) {
+            xfer->resumes--;
+            xfer->status.resumes++;
+            return tuya_xfer_restart(xfer);
+        }
+        tuya_xfer_finish(xfer, TUYA_XFER_FAILED);
+        return -1;
+    }
+    xfer->status.retries++;
+    if (xfer->status.state == TUYA_XFER_STARTING)
+        return tuya_xfer_send_start(xfer);
+
+    // Go back to the oldest packet in flight, later ones are sent again in order
+    for (uint8_t i = 0; i < xfer->in_flight; i++) {
+        struct tuya_xfer_packet *packet = &xfer->packets[(xfer->head + i) % xfer->slots];
+        if (tuya_xfer_send_packet(xfer, packet) < 0)
+            return -1;
+        packet->resent++;
+    }
+    xfer->sent_at = tick;
+    return 0;
+}
+
+void tuya_xfer_abort(tuya_xfer_t xfer)
+{
+    if (xfer && !tuya_xfer_finished(xfer))
+        tuya_xfer_finish(xfer, TUYA_XFER_FAILED);
+}
+
+void tuya_xfer_get_status(tuya_xfer_t xfer, tuya_xfer_status_t *status)
+{
+    *status = xfer->status;
+}
+
+bool tuya_xfer_finished(tuya_xfer_t xfer)
+{
+    return xfer->status.state == TUYA_XFER_DONE || xfer->status.state == TUYA_XFER_FAILED;
+}
+
+void tuya_xfer_destroy(tuya_xfer_t xfer)
+{
+    if (!xfer)
+        return;
+
+    tuya_mcu_register_cmd_handler(xfer->mcu, xfer->proto->start_cmd, xfer->prev_start, xfer->prev_start_arg);
+    tuya_mcu_register_cmd_handler(xfer->mcu, xfer->proto->trans_cmd, xfer->prev_trans, xfer->prev_trans_arg);
+    free(xfer->buf);
+    free(xfer);
+}
+
+/* MCU firmware upgrade: start carries the image size, packets a 4 byte offset */
+static size_t ota_build_start(struct tuya_xfer *xfer, uint8_t *buf, size_t len)
+{
+    uint32_t size = xfer->status.size;
+
+    buf[0] = size >> 24;
+    buf[1] = (size >> 16) & 0xFF;
+    buf[2] = (size >> 8) & 0xFF;
+    buf[3] = size & 0xFF;
+    return 4;
+}
+
+static size_t ota_build_hdr(struct tuya_xfer *xfer, uint32_t offset, uint8_t *buf)
+{
+    buf[0] = offset >> 24;
+    buf[1] = (offset >> 16) & 0xFF;
+    buf[2] = (offset >> 8) & 0xFF;
+    buf[3] = offset & 0xFF;
+    return 4;
+}
+
+static const struct tuya_xfer_proto ota_proto = {
+    .start_cmd = UPDATE_START_CMD,
+    .trans_cmd = UPDATE_TRANS_CMD,
+    .build_start = ota_build_start,
+    .build_hdr = ota_build_hdr,
+};
+
+tuya_xfer_t tuya_xfer_start_ota(tuya_mcu_t mcu, const tuya_xfer_config_t *config)
+{
+    struct tuya_xfer *xfer = tuya_xfer_create(mcu, &ota_proto, config);
+    return xfer ? tuya_xfer_begin(xfer) : NULL;
+}
+
+/* File download: start carries the file description, packets the file id and a 4 byte offset */
+static size_t file_build_start(struct tuya_xfer *xfer, uint8_t *buf, size_t len)
+{
+    int n = snprintf((char *)buf, len, "{\"name\":\"%s\",\"id\":%u,\"len\":%" PRIu32 ",\"type\":%u}", xfer->name,
+                     xfer->file_id, xfer->status.size, xfer->file_type);
+    return n < 0 ? 0 : (size_t)n < len ? (size_t)n : len - 1;
+}
+
+static size_t file_build_hdr(struct tuya_xfer *xfer, uint32_t offset, uint8_t *buf)
+{
+    buf[0] = xfer->file_id >> 8;
+    buf[1] = xfer->file_id & 0xFF;
+    buf[2] = offset >> 24;
+    buf[3] = (offset >> 16) & 0xFF;
+    buf[4] = (offset >> 8) & 0xFF;
+    buf[5] = offset & 0xFF;
+    return 6;
+}
+
+/* Optional status byte, 0 accepts the packet */
+static int file_parse_ack(struct tuya_xfer *xfer, const uint8_t *data, size_t len)
+{
+    return len > 0 && data[0] != 0 ? -1 : 0;
+}
+
+static const struct tuya_xfer_proto file_proto = {
+    .start_cmd = FILE_DOWNLOAD_START_CMD,
+    .trans_cmd = FILE_DOWNLOAD_TRANS_CMD,
+    .build_start = file_build_start,
+    .build_hdr = file_build_hdr,
+    .parse_ack = file_parse_ack,
+};
+
+tuya_xfer_t tuya_xfer_start_file(tuya_mcu_t mcu, const tuya_xfer_config_t *config, const tuya_xfer_file_t *file)
+{
+    struct tuya_xfer *xfer;
+
+    if (!file || !file->name || strlen(file->name) > TUYA_XFER_NAME_LEN || strpbrk(file->name, "\"\\"))
+        return NULL;
+
+    xfer = tuya_xfer_create(mcu, &file_proto, config);
+    if (!xfer)
+        return NULL;
+
+    strcpy(xfer->name, file->name);
+    xfer->file_id = file->id;
+    xfer->file_type = file->type;
+    return tuya_xfer_begin(xfer);
+}
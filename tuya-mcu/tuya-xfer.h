@@ -0,0 +1,71 @@
+#pragma once
+
+#include <stdbool.h>
+#include <inttypes.h>
+#include <stddef.h>
+
+#include "tuya-mcu.h"
+
+#define TUYA_XFER_WINDOW_MAX 4  // Max packets awaiting their ack
+#define TUYA_XFER_NAME_LEN   32 // Max file name length
+
+typedef struct tuya_xfer *tuya_xfer_t;
+
+enum tuya_xfer_state {
+    TUYA_XFER_STARTING = 0, // Waiting for the MCU to accept the transfer
+    TUYA_XFER_SENDING,      // Packets in flight
+    TUYA_XFER_DONE,         // MCU acked the end of the transfer
+    TUYA_XFER_FAILED,       // Aborted, reader error or MCU stopped answering
+};
+
+typedef struct {
+    enum tuya_xfer_state state;
+    uint32_t             size;          // Image size
+    uint32_t             acked;         // Bytes acked by the MCU
+    uint32_t             bytes_per_sec; // Average rate since the MCU accepted the transfer
+    uint16_t             packet_size;   // Packet size requested by the MCU
+    uint16_t             retries;       // Packets sent again so far
+    uint8_t              resumes;       // Restarts from the last acked offset so far
+} tuya_xfer_status_t;
+
+/* Fill buf with len bytes of the image at offset, returns bytes read or <0 on error */
+typedef int (*tuya_xfer_read_t)(void *arg, uint32_t offset, uint8_t *buf, size_t len);
+/* Called after every ack and once more when the transfer is done or failed */
+typedef void (*tuya_xfer_progress_t)(tuya_xfer_t xfer, const tuya_xfer_status_t *status, void *arg);
+
+typedef struct {
+    uint32_t             size;         // Image size
+    tuya_xfer_read_t     read;         // Image reader
+    void                *read_arg;     // Argument for reader
+    tuya_xfer_progress_t progress;     // Progress callback, may be NULL
+    void                *progress_arg; // Argument for progress callback
+    uint8_t              window;       // Packets in flight, 1 unless the MCU is known to queue them
+    uint32_t             timeout_ms;   // Time to wait for an ack before sending again
+    uint8_t              retries;      // Times a packet is sent again before giving up
+    uint8_t              resumes;      // Times the transfer restarts from the last acked offset before failing
+    uint32_t             offset;       // Offset to start from, acked bytes of an earlier attempt
+} tuya_xfer_config_t;
+
+/* File pushed with tuya_xfer_start_file */
+typedef struct {
+    const char *name; // File name, up to TUYA_XFER_NAME_LEN characters
+    uint16_t    id;   // File id
+    uint8_t     type; // File type
+} tuya_xfer_file_t;
+
+/* Start MCU firmware upgrade (UPDATE_START_CMD/UPDATE_TRANS_CMD), takes over both commands until
+   destroyed, which restores their previous handlers */
+tuya_xfer_t tuya_xfer_start_ota(tuya_mcu_t mcu, const tuya_xfer_config_t *config);
+/* Start file download (FILE_DOWNLOAD_START_CMD/FILE_DOWNLOAD_TRANS_CMD), takes over both commands
+   until destroyed, which restores their previous handlers */
+tuya_xfer_t tuya_xfer_start_file(tuya_mcu_t mcu, const tuya_xfer_config_t *config, const tuya_xfer_file_t *file);
+/* Restart a failed transfer from the last acked offset */
+int  tuya_xfer_resume(tuya_xfer_t xfer);
+/* Resend on timeout; call it periodically, acks are handled from tuya_mcu_tick */
+int  tuya_xfer_tick(tuya_xfer_t xfer);
+/* ms until tuya_xfer_tick has a resend due, UINT32_MAX if none */
+uint32_t tuya_xfer_next_deadline(tuya_xfer_t xfer);
+void tuya_xfer_abort(tuya_xfer_t xfer);
+void tuya_xfer_get_status(tuya_xfer_t xfer, tuya_xfer_status_t *status);
+bool tuya_xfer_finished(tuya_xfer_t xfer);
+void tuya_xfer_destroy(tuya_xfer_t xfer);